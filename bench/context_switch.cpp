@@ -0,0 +1,60 @@
+#include "src/context.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ucontext.h>
+
+constexpr long SWITCHES = 10000000;
+constexpr size_t STACK_SIZE = 65536;
+
+static Context main_ctx, fiber_ctx;
+static ucontext_t main_uctx, fiber_uctx;
+
+// Bounce straight back to main on every switch
+[[noreturn]] static void asm_fiber(void *, void *) {
+    while (true) {
+        context_switch(&fiber_ctx, &main_ctx);
+    }
+}
+
+[[noreturn]] static void ucontext_fiber() {
+    while (true) {
+        swapcontext(&fiber_uctx, &main_uctx);
+    }
+}
+
+static void report(const char *name, std::chrono::steady_clock::duration elapsed) {
+    double secs = std::chrono::duration<double>(elapsed).count();
+    // Each iteration is a round trip, i.e. two switches
+    double rate = 2.0 * SWITCHES / secs;
+    printf("%-12s %12.0f switches/s %8.1f ns/switch\n", name, rate, 1e9 / rate);
+}
+
+int main() {
+    void *asm_stack = malloc(STACK_SIZE);
+    void *ucontext_stack = malloc(STACK_SIZE);
+
+    printf("context switch benchmark, %ld round trips\n", SWITCHES);
+
+    context_make(&fiber_ctx, asm_stack, STACK_SIZE, asm_fiber, nullptr, nullptr);
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < SWITCHES; i++) {
+        context_switch(&main_ctx, &fiber_ctx);
+    }
+    report("asm", std::chrono::steady_clock::now() - start);
+
+    getcontext(&fiber_uctx);
+    fiber_uctx.uc_stack.ss_sp = ucontext_stack;
+    fiber_uctx.uc_stack.ss_size = STACK_SIZE;
+    fiber_uctx.uc_link = nullptr;
+    makecontext(&fiber_uctx, ucontext_fiber, 0);
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < SWITCHES; i++) {
+        swapcontext(&main_uctx, &fiber_uctx);
+    }
+    report("ucontext", std::chrono::steady_clock::now() - start);
+
+    free(asm_stack);
+    free(ucontext_stack);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#include "src/microfiber.hpp"
+#include "src/queue.hpp"
+#include <arpa/inet.h>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr int MSG_SIZE = 64;
+
+static int connections = 10000;
+static int rounds = 20;
+static int listen_fd;
+static struct sockaddr_in server_addr;
+
+// Server side: echo everything back until the client hangs up
+static int echo(void *arg) {
+    int fd = static_cast<int>(reinterpret_cast<long>(arg));
+    char buf[4096];
+    ssize_t n;
+    while ((n = MicroFiber::io_read(fd, buf, sizeof(buf))) > 0) {
+        if (MicroFiber::io_write(fd, buf, static_cast<size_t>(n)) != n) {
+            break;
+        }
+    }
+    MicroFiber::io_close(fd);
+    return 0;
+}
+
+static void serve() {
+    for (int i = 0; i < connections; i++) {
+        int fd = MicroFiber::io_accept(listen_fd, nullptr, nullptr);
+        assert(fd >= 0);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ThreadID tid = MicroFiber::thread_create(echo, reinterpret_cast<void *>(static_cast<long>(fd)), 0);
+        assert(tid >= 0);
+        (void) tid;
+    }
+}
+
+// Client side: every connection waits at a barrier once connected, so only the round trips are timed
+static FifoQueue *barrier;
+static int connected = 0;
+static std::chrono::steady_clock::time_point start;
+
+static int client(void *arg) {
+    (void) arg;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = MicroFiber::io_connect(fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == 0);
+    (void) ret;
+
+    if (++connected < connections) {
+        MicroFiber::thread_sleep(barrier);
+    } else {
+        start = std::chrono::steady_clock::now();
+        MicroFiber::thread_wakeup(barrier, true);
+    }
+
+    char out[MSG_SIZE], in[MSG_SIZE];
+    memset(out, 'x', sizeof(out));
+    for (int r = 0; r < rounds; r++) {
+        ssize_t n = MicroFiber::io_write(fd, out, sizeof(out));
+        assert(n == MSG_SIZE);
+        size_t got = 0;
+        while (got < sizeof(in)) {
+            n = MicroFiber::io_read(fd, in + got, sizeof(in) - got);
+            assert(n > 0);
+            got += static_cast<size_t>(n);
+        }
+    }
+    MicroFiber::io_close(fd);
+    return 0;
+}
+
+static void run_clients() {
+    barrier = new FifoQueue();
+    auto *tids = new ThreadID[connections];
+    for (int i = 0; i < connections; i++) {
+        tids[i] = MicroFiber::thread_create(client, nullptr, 0);
+        assert(tids[i] >= 0);
+    }
+    for (int i = 0; i < connections; i++) {
+        MicroFiber::thread_wait(tids[i], nullptr);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double requests = static_cast<double>(connections) * rounds;
+
+    printf("%d connections x %d round trips of %d bytes: %.2f s, %.0f requests/s\n", connections, rounds, MSG_SIZE,
+           secs, requests / secs);
+    fflush(stdout);
+}
+
+// Loopback echo server and client, each in a process of its own with a MicroFiber runtime and one thread per
+// connection. Usage: bench_echo [connections [round trips per connection]]
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        connections = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        rounds = atoi(argv[2]);
+    }
+
+    // Each process holds one fd per connection, plus a few of its own
+    struct rlimit lim{};
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    if (static_cast<rlim_t>(connections) + 64 > lim.rlim_cur) {
+        connections = static_cast<int>(lim.rlim_cur) - 64;
+        printf("fd limit is %lu, using %d connections\n", static_cast<unsigned long>(lim.rlim_cur), connections);
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listen_fd >= 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int ret = bind(listen_fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == 0);
+    socklen_t len = sizeof(server_addr);
+    ret = getsockname(listen_fd, reinterpret_cast<struct sockaddr *>(&server_addr), &len);
+    assert(ret == 0);
+    ret = listen(listen_fd, SOMAXCONN);
+    assert(ret == 0);
+    (void) ret;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    assert(pid >= 0);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = false,
+            .max_threads = static_cast<unsigned>(connections) + 2,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    if (pid == 0) {
+        close(listen_fd);
+        run_clients();
+    } else {
+        serve();
+        // The connection threads run until their client hangs up
+        int status;
+        while (waitpid(pid, &status, WNOHANG) == 0) {
+            MicroFiber::thread_sleep_for(10000);
+        }
+    }
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,110 @@
+#include "src/microfiber.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// Below this argument fib recurses as plain calls, so each thread has enough work to be worth stealing
+constexpr long SERIAL_BELOW = 20;
+
+struct Result {
+    uint64_t elapsed_us;
+    long value;
+    StealStats stats;
+};
+
+static long fib_serial(long n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+// Forks a thread per recursive call above the cutoff, the way a fork-join task would
+static int fib(void *arg) {
+    long n = reinterpret_cast<long>(arg);
+    if (n < SERIAL_BELOW) {
+        return static_cast<int>(fib_serial(n));
+    }
+    ThreadID a = MicroFiber::thread_create(fib, reinterpret_cast<void *>(n - 1), 0);
+    ThreadID b = MicroFiber::thread_create(fib, reinterpret_cast<void *>(n - 2), 0);
+    int x, y;
+    MicroFiber::thread_wait(a, &x);
+    MicroFiber::thread_wait(b, &y);
+    return x + y;
+}
+
+// Runs in a child process, as the runtime is started once per process
+[[noreturn]] static void run(unsigned nworkers, long n, int fd) {
+    Config config = {
+            .scheduler_name = Config::SchedulerType::WorkStealing,
+            .is_preemptive = true,
+            .workers = nworkers,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    Result result = {};
+    uint64_t before = MicroFiber::get_time_us();
+    ThreadID root = MicroFiber::thread_create(fib, reinterpret_cast<void *>(n), 0);
+    int value;
+    MicroFiber::thread_wait(root, &value);
+    result.elapsed_us = MicroFiber::get_time_us() - before;
+    result.value = value;
+    result.stats = MicroFiber::get_steal_stats();
+
+    ssize_t ret = write(fd, &result, sizeof(result));
+    (void) ret;
+    MicroFiber::thread_exit(0);
+}
+
+// Parallel fib on the WorkStealing scheduler with 1, 2, 4... workers up to the given maximum (the number of CPUs by
+// default), reporting the speedup over one worker and how many threads were stolen
+int main(int argc, const char *argv[]) {
+    long n = argc > 1 ? atol(argv[1]) : 40;
+    unsigned max_workers = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : std::thread::hardware_concurrency();
+    if (max_workers == 0) {
+        max_workers = 1;
+    }
+
+    printf("fib(%ld), threads forked above %ld\n", n, SERIAL_BELOW);
+    double base = 0;
+    for (unsigned nworkers = 1;; nworkers *= 2) {
+        if (nworkers > max_workers) {
+            nworkers = max_workers;
+        }
+        // The child must not flush what the parent has printed so far
+        fflush(stdout);
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return EXIT_FAILURE;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            run(nworkers, n, fds[1]);
+        }
+        close(fds[1]);
+        Result result = {};
+        ssize_t got = read(fds[0], &result, sizeof(result));
+        close(fds[0]);
+        waitpid(pid, nullptr, 0);
+        if (got != sizeof(result)) {
+            fprintf(stderr, "run with %u workers failed\n", nworkers);
+            return EXIT_FAILURE;
+        }
+
+        double seconds = static_cast<double>(result.elapsed_us) / 1e6;
+        if (nworkers == 1) {
+            base = seconds;
+        }
+        printf("%3u workers: %.3f s  speedup %5.2f  steals %8lu  failed sweeps %8lu  (= %ld)\n", nworkers, seconds,
+               base / seconds, result.stats.steals, result.stats.failed, result.value);
+        if (nworkers == max_workers) {
+            break;
+        }
+    }
+    return 0;
+}
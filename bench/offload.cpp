@@ -0,0 +1,67 @@
+#include "src/microfiber.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+constexpr int CALLS = 20000;
+constexpr int BUSY_THREADS = 8;
+
+static volatile bool stop = false;
+
+static int nothing(void *arg) {
+    return static_cast<int>(reinterpret_cast<long>(arg));
+}
+
+// Keeps the run queue non-empty, so completions are found by the periodic poll instead of the idle wait
+static int busy(void *arg) {
+    (void) arg;
+    while (!stop) {
+        MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    }
+    return 0;
+}
+
+// Round trip of an empty call through the pool: queueing the job, a worker waking up and running it, the eventfd kick
+// and the caller being resumed
+static void measure(const char *name) {
+    std::vector<uint64_t> samples(CALLS);
+    for (auto &sample: samples) {
+        uint64_t before = MicroFiber::get_time_us();
+        MicroFiber::offload(nothing, nullptr);
+        sample = MicroFiber::get_time_us() - before;
+    }
+    std::sort(samples.begin(), samples.end());
+    uint64_t total = 0;
+    for (uint64_t sample: samples) {
+        total += sample;
+    }
+    printf("%-8s mean %6.1f us  p50 %4lu us  p99 %5lu us  max %6lu us\n", name, static_cast<double>(total) / CALLS,
+           static_cast<unsigned long>(samples[CALLS / 2]), static_cast<unsigned long>(samples[CALLS * 99 / 100]),
+           static_cast<unsigned long>(samples.back()));
+}
+
+int main() {
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = true,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    printf("offload handoff latency, %d calls\n", CALLS);
+
+    // Start the pool outside the measurement
+    MicroFiber::offload(nothing, nullptr);
+    measure("idle");
+
+    ThreadID tids[BUSY_THREADS];
+    for (ThreadID &tid: tids) {
+        tid = MicroFiber::thread_create(busy, nullptr, 0);
+    }
+    measure("busy");
+    stop = true;
+    for (ThreadID tid: tids) {
+        MicroFiber::thread_wait(tid, nullptr);
+    }
+
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,46 @@
+#include "src/microfiber.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+constexpr int FIBERS = 64;
+constexpr unsigned long ITERATIONS = 20000000;
+
+static volatile unsigned long sink;
+
+// Pure computation, never yielding: the only runtime work is the preemption tick
+static int compute(void *arg) {
+    unsigned long x = reinterpret_cast<unsigned long>(arg) + 1;
+    for (unsigned long i = 0; i < ITERATIONS; i++) {
+        x = x * 6364136223846793005ul + 1442695040888963407ul;
+    }
+    sink = x;
+    return 0;
+}
+
+// CPU-bound fibers spread round-robin over the given number of workers. Compare the rate across worker counts up to
+// the number of cores to see how it scales.
+int main(int argc, const char *argv[]) {
+    unsigned nworkers = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 1;
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = true,
+            .workers = nworkers,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    uint64_t before = MicroFiber::get_time_us();
+    ThreadID tids[FIBERS];
+    for (long i = 0; i < FIBERS; i++) {
+        tids[i] = MicroFiber::thread_create(compute, reinterpret_cast<void *>(i), 0);
+    }
+    for (ThreadID tid: tids) {
+        MicroFiber::thread_wait(tid, nullptr);
+    }
+    uint64_t elapsed = MicroFiber::get_time_us() - before;
+
+    printf("%u workers: %d fibers x %lu iterations in %.3f s, %.1f M iterations/s\n", nworkers, FIBERS, ITERATIONS,
+           static_cast<double>(elapsed) / 1e6, static_cast<double>(FIBERS) * ITERATIONS / static_cast<double>(elapsed));
+
+    MicroFiber::thread_exit(0);
+}
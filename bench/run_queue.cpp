@@ -0,0 +1,66 @@
+#include "src/queue.hpp"
+#include "src/thread_manager.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+constexpr int SIZES[] = {1000, 10000, 100000};
+constexpr int OPS = 2000;
+constexpr int PRIO_RANGE = 64;
+
+// Average nanoseconds per call of op over OPS calls
+template<typename Op>
+static double time_ops(Op op) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < OPS; i++) {
+        op(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / OPS;
+}
+
+int main() {
+    std::mt19937 rng(0);
+
+    printf("run queue benchmark, %zu bytes per thread, %d ops per size\n", sizeof(Thread), OPS);
+    printf("%8s %14s %14s %16s\n", "threads", "push+pop ns", "sorted ns", "remove+push ns");
+
+    for (int n: SIZES) {
+        std::vector<Thread> threads(n);
+        FifoQueue queue;
+
+        // Fill the queue in priority order so it starts out sorted
+        for (int i = 0; i < n; i++) {
+            threads[i].id = i;
+            threads[i].prio = i * PRIO_RANGE / n;
+            threads[i].state = Thread::State::READY;
+            threads[i].initialized = true;
+            queue.push(&threads[i]);
+        }
+
+        double fifo = time_ops([&](int) {
+            queue.push(queue.pop());
+        });
+
+        // Re-sort, then insert in sorted order: every insertion walks the list
+        while (queue.pop() != nullptr);
+        for (int i = 0; i < n; i++) {
+            queue.push(&threads[i]);
+        }
+        double sorted = time_ops([&](int) {
+            Thread *t = queue.pop();
+            t->prio = static_cast<int>(rng() % PRIO_RANGE);
+            queue.push_sorted(t);
+        });
+
+        double remove = time_ops([&](int) {
+            Thread *t = queue.remove(&threads[rng() % n]);
+            queue.push(t);
+        });
+
+        printf("%8d %14.1f %14.1f %16.1f\n", n, fifo, sorted, remove);
+        while (queue.pop() != nullptr);
+    }
+    return 0;
+}
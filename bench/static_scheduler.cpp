@@ -0,0 +1,60 @@
+#include "src/microfiber.hpp"
+#include "src/microfiber_static.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr int NTHREADS = 8;
+constexpr long YIELDS = 2000000;
+
+template<class Runtime>
+static int yielder(void *arg) {
+    (void) arg;
+    for (long i = 0; i < YIELDS / NTHREADS; i++) {
+        Runtime::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    }
+    return 0;
+}
+
+// Time NTHREADS threads yielding to each other, in a child process since a runtime can only be started once
+template<class Runtime>
+static void run(const char *name) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid > 0) {
+        int status;
+        waitpid(pid, &status, 0);
+        return;
+    }
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = false
+    };
+    Runtime::microfiber_start(&config);
+
+    ThreadID tid[NTHREADS];
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < NTHREADS; i++) {
+        tid[i] = Runtime::thread_create(yielder<Runtime>, nullptr, 0);
+        assert(tid[i] >= 0);
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        MicroFiber::thread_wait(tid[i], nullptr);
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-24s %12.0f yields/s %8.1f ns/yield\n", name, YIELDS / secs, secs * 1e9 / YIELDS);
+    fflush(stdout);
+    MicroFiber::thread_exit(0);
+}
+
+int main() {
+    printf("scheduler dispatch benchmark, %d threads, %ld yields\n", NTHREADS, YIELDS);
+    fflush(stdout);
+    run<MicroFiber>("MicroFiber (virtual)");
+    run<StaticMicroFiber<FCFSPolicy>>("StaticMicroFiber<FCFS>");
+    return 0;
+}
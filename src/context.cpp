@@ -0,0 +1,79 @@
+#include "context.hpp"
+#include <cstdint>
+#include <cstring>
+
+#if !defined(__x86_64__)
+#error "MicroFiber context switching is only implemented for x86-64"
+#endif
+
+// The frame pushed by context_switch, from the lowest address (the saved stack pointer) upwards
+struct SwitchFrame {
+    uint32_t mxcsr;
+    uint16_t fpu_cw;
+    uint16_t pad;
+    uint64_t r15;
+    uint64_t r14;
+    uint64_t r13;
+    uint64_t r12;
+    uint64_t rbx;
+    uint64_t rbp;
+    uint64_t ret;
+};
+
+extern "C" void context_trampoline();
+
+// System V x86-64: rbx, rbp and r12-r15 are callee-saved, as are the control bits of MXCSR and the x87 control word
+asm(R"(
+    .text
+    .globl context_switch
+    .type context_switch, @function
+context_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq (%rsi), %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size context_switch, .-context_switch
+
+    .globl context_trampoline
+    .type context_trampoline, @function
+context_trampoline:
+    movq %r13, %rdi
+    movq %r14, %rsi
+    callq *%r12
+    ud2
+    .size context_trampoline, .-context_trampoline
+)");
+
+void context_make(Context *ctx, void *stack, size_t size, ContextEntry entry, void *arg0, void *arg1) {
+    // The trampoline is entered by ret with a 16-byte aligned stack pointer, so the call it makes leaves entry
+    // with the alignment the ABI expects
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~static_cast<uintptr_t>(15);
+    auto *frame = reinterpret_cast<SwitchFrame *>(top - sizeof(SwitchFrame));
+
+    std::memset(frame, 0, sizeof(SwitchFrame));
+    asm volatile("stmxcsr %0" : "=m"(frame->mxcsr));
+    asm volatile("fnstcw %0" : "=m"(frame->fpu_cw));
+    frame->r12 = reinterpret_cast<uint64_t>(entry);
+    frame->r13 = reinterpret_cast<uint64_t>(arg0);
+    frame->r14 = reinterpret_cast<uint64_t>(arg1);
+    frame->ret = reinterpret_cast<uint64_t>(context_trampoline);
+
+    ctx->sp = frame;
+}
@@ -0,0 +1,22 @@
+#ifndef MICROFIBER_CONTEXT_H
+#define MICROFIBER_CONTEXT_H
+
+#include <cstddef>
+
+// Saved execution state of a suspended fiber. The callee-saved registers are pushed onto the fiber's own stack by
+// context_switch, so only the stack pointer needs to be kept here.
+struct Context {
+    void *sp;
+};
+
+// Entry point of a new context, called with the two arguments given to context_make
+using ContextEntry = void (*)(void *, void *);
+
+// Prepare ctx so that the first context_switch to it runs entry(arg0, arg1) on the given stack
+void context_make(Context *ctx, void *stack, size_t size, ContextEntry entry, void *arg0, void *arg1);
+
+// Save the caller's callee-saved registers and stack pointer in from, then resume the context saved in to.
+// Unlike swapcontext, the signal mask and the full FPU state are not touched, so no system call is made.
+extern "C" void context_switch(Context *from, Context *to);
+
+#endif //MICROFIBER_CONTEXT_H
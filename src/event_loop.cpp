@@ -0,0 +1,335 @@
+#include "event_loop.hpp"
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "thread_manager.hpp"
+#include "queue.hpp"
+#include "timer_wheel.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+#include "worker.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Maximum number of events taken from the kernel at once
+constexpr int EVENT_BATCH = 256;
+
+// Number of fd entries added to the table at a time, and the chunks needed to cover every non-negative int
+constexpr unsigned FD_CHUNK_SHIFT = 10;
+constexpr unsigned FD_CHUNK_SIZE = 1u << FD_CHUNK_SHIFT;
+constexpr size_t FD_CHUNKS_MAX = size_t(1) << (31 - FD_CHUNK_SHIFT);
+
+std::atomic<unsigned long> io_waiter_count(0);
+thread_local unsigned event_poll_skipped = 0;
+
+static int epoll_fd = -1;
+
+// Threads waiting on one fd. Edge-triggered registration reports each new arrival of data or buffer space, so every
+// waiter of the direction is woken and those that still find the fd not ready wait again. Each queue is guarded by its
+// wait lock.
+struct FdState {
+    FifoQueue readers;          // threads waiting for POLLIN
+    FifoQueue writers;          // threads waiting for POLLOUT
+    FifoQueue any;              // threads waiting for either
+    std::atomic<unsigned> edges{0};         // edges dispatched so far, and forgets
+    std::atomic<int8_t> registered{-1};     // 1 if in the epoll set, 0 if not pollable, -1 if not looked at yet
+};
+
+// The fd table grows in chunks that are never moved, as the wait queues must stay where their threads point. The
+// directory of chunks is reserved whole up front, so that any worker finds an entry without a lock; only adding a
+// chunk takes fd_lock.
+static std::atomic<FdState *> *fd_chunks = nullptr;
+static WordLock fd_lock;
+
+// One past the highest chunk added, guarded by fd_lock
+static size_t fd_chunk_limit = 0;
+
+// The entry of fd if the table covers it
+static FdState *fd_find(int fd) {
+    if (fd < 0 || fd_chunks == nullptr) {
+        return nullptr;
+    }
+    FdState *chunk = fd_chunks[static_cast<size_t>(fd) >> FD_CHUNK_SHIFT].load(std::memory_order_acquire);
+    return chunk != nullptr ? &chunk[fd & (FD_CHUNK_SIZE - 1)] : nullptr;
+}
+
+// The entry of fd, growing the table if needed, or nullptr if out of memory
+static FdState *fd_state(int fd) {
+    FdState *s = fd_find(fd);
+    if (s != nullptr) {
+        return s;
+    }
+    std::atomic<FdState *> &slot = fd_chunks[static_cast<size_t>(fd) >> FD_CHUNK_SHIFT];
+    fd_lock.lock();
+    FdState *chunk = slot.load(std::memory_order_relaxed);
+    if (chunk == nullptr) {
+        chunk = new(std::nothrow) FdState[FD_CHUNK_SIZE];
+        slot.store(chunk, std::memory_order_release);
+        if (chunk != nullptr && &slot - fd_chunks >= static_cast<ptrdiff_t>(fd_chunk_limit)) {
+            fd_chunk_limit = static_cast<size_t>(&slot - fd_chunks) + 1;
+        }
+    }
+    fd_lock.unlock();
+    return chunk != nullptr ? &chunk[fd & (FD_CHUNK_SIZE - 1)] : nullptr;
+}
+
+// The queue a thread waiting for events (POLLIN, POLLOUT or both) on fd parks on
+static FifoQueue &fd_queue(FdState *s, short events) {
+    if ((events & (POLLIN | POLLOUT)) == (POLLIN | POLLOUT)) {
+        return s->any;
+    }
+    return events & POLLOUT ? s->writers : s->readers;
+}
+
+// Make every thread in queue ready, ending its wait with revents. A thread that something else claimed first, its
+// timer or a killer, is only taken off the queue.
+static void wake_all(FifoQueue &queue, short revents) {
+    WordLock &lock = wait_lock(&queue);
+    WokenList woken;
+    lock.lock();
+    while (Thread *t = queue.pop()) {
+        if (thread_claim(t)) {
+            t->io_revents = revents;
+            woken.push(t);
+        }
+    }
+    lock.unlock();
+    woken.ready(*scheduler);
+}
+
+// Wake the waiters of fd according to the events epoll reported. The edge is counted first, so that a thread about to
+// park either sees it or is on the queue by the time the queue is emptied.
+static void dispatch(int fd, uint32_t events) {
+    FdState *s = fd_find(fd);
+    if (s == nullptr) {
+        return;
+    }
+    s->edges.fetch_add(1);
+
+    // Errors and hang-ups are reported to both directions, as poll does
+    auto revents = static_cast<short>(events & (POLLIN | POLLOUT | POLLERR | POLLHUP | POLLPRI | POLLRDHUP));
+    bool failed = events & (EPOLLERR | EPOLLHUP);
+    if (failed || (events & (EPOLLIN | EPOLLRDHUP | EPOLLPRI))) {
+        wake_all(s->readers, static_cast<short>(revents & ~POLLOUT));
+    }
+    if (failed || (events & EPOLLOUT)) {
+        wake_all(s->writers, static_cast<short>(revents & ~(POLLIN | POLLPRI | POLLRDHUP)));
+    }
+    wake_all(s->any, revents);
+}
+
+void event_loop_init() {
+    assert(epoll_fd < 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("Creating epoll instance");
+        assert(0);
+    }
+    io_waiter_count.store(0);
+    event_poll_skipped = 0;
+    void *chunks = mmap(nullptr, FD_CHUNKS_MAX * sizeof(*fd_chunks), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (chunks == MAP_FAILED) {
+        perror("Reserving fd table");
+        assert(0);
+    }
+    fd_chunks = static_cast<std::atomic<FdState *> *>(chunks);
+
+    // The ring fd turns readable when completions arrive, so the idle wait ends for them too
+    if (uring_enabled()) {
+        event_loop_watch(uring_fd());
+    }
+}
+
+void event_loop_watch(int fd) {
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void event_loop_end() {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (fd_chunks != nullptr) {
+        for (size_t i = 0; i < fd_chunk_limit; i++) {
+            delete[] fd_chunks[i].load(std::memory_order_relaxed);
+        }
+        fd_chunk_limit = 0;
+        munmap(fd_chunks, FD_CHUNKS_MAX * sizeof(*fd_chunks));
+        fd_chunks = nullptr;
+    }
+    io_waiter_count.store(0);
+}
+
+int event_loop_register(int fd) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    FdState *s = fd_state(fd);
+    if (s == nullptr) {
+        errno = ENOMEM;
+        return -1;
+    }
+    int8_t registered = s->registered.load(std::memory_order_acquire);
+    if (registered >= 0) {
+        return registered;
+    }
+
+    // Two workers may register the fd at once, the second finds it in the set already
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLPRI | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        if (errno == EPERM) {
+            s->registered.store(0, std::memory_order_release);
+            return 0;
+        }
+        if (errno != EEXIST) {
+            return -1;
+        }
+    }
+
+    // Waits only happen on EAGAIN, so the fd must not block the whole process
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && !(flags & O_NONBLOCK)) {
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    s->registered.store(1, std::memory_order_release);
+    return 1;
+}
+
+unsigned event_loop_edges(int fd) {
+    FdState *s = fd_find(fd);
+    return s != nullptr ? s->edges.load() : 0;
+}
+
+bool event_loop_add(Thread *thread, int fd, short events, unsigned edges) {
+    FdState *s = fd_find(fd);
+    assert(s != nullptr && thread->io_fd < 0);
+    FifoQueue &queue = fd_queue(s, events);
+    WordLock &lock = wait_lock(&queue);
+    lock.lock();
+    if (s->edges.load() != edges) {
+        lock.unlock();
+        return false;
+    }
+    thread->io_fd = fd;
+    thread->io_revents = 0;
+    io_waiter_count.fetch_add(1, std::memory_order_relaxed);
+    int ret = queue.push(thread);
+    assert(ret == 0);
+    (void) ret;
+    lock.unlock();
+    return true;
+}
+
+void event_loop_cancel(Thread *thread) {
+    if (thread->io_fd < 0) {
+        return;
+    }
+    thread->io_fd = -1;
+    io_waiter_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void event_loop_forget(int fd) {
+    FdState *s = fd_find(fd);
+    if (s == nullptr) {
+        return;
+    }
+    s->edges.fetch_add(1);
+    wake_all(s->readers, POLLNVAL);
+    wake_all(s->writers, POLLNVAL);
+    wake_all(s->any, POLLNVAL);
+    if (s->registered.load(std::memory_order_relaxed) == 1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    s->registered.store(-1, std::memory_order_release);
+}
+
+void event_loop_wait(bool block) {
+    int timeout_set = 0;
+    struct timespec timeout{};
+
+    if (uring_inflight != 0) {
+        if (uring_has_queued()) {
+            uring_submit();
+        }
+        // Operations the kernel could complete right away need no wait
+        if (uring_reap() != 0) {
+            block = false;
+        }
+    }
+    if (offload_has_done() && offload_reap() != 0) {
+        block = false;
+    }
+    if (wake_has_fired() && wake_reap() != 0) {
+        block = false;
+    }
+
+    if (block) {
+        uint64_t next = timer_wheel_next_us();
+        if (next != UINT64_MAX) {
+            uint64_t now = timer_now_us();
+            uint64_t wait = next > now ? next - now : 0;
+            timeout.tv_sec = static_cast<time_t>(wait / 1000000);
+            timeout.tv_nsec = static_cast<long>(wait % 1000000) * 1000;
+            timeout_set = 1;
+        } else {
+            // Other workers may still make a thread of this one ready, and kick it
+            assert(event_loop_pending() || multi_worker());
+        }
+        InterruptManager::timer_disarm();
+    } else {
+        timeout_set = 1;
+    }
+    event_poll_skipped = 0;
+
+    struct epoll_event events[EVENT_BATCH];
+    int n = 0;
+    if (event_loop_pending() || block) {
+        // A preemption tick or another signal may cut the wait short, which is harmless since the caller tries again.
+        // The other workers go on meanwhile.
+        if (block) {
+            worker_park_begin();
+        }
+        n = epoll_pwait2(epoll_fd, events, EVENT_BATCH, timeout_set ? &timeout : nullptr, nullptr);
+        if (n < 0 && errno == ENOSYS) {
+            // Kernels before 5.11 only take a timeout in milliseconds, round it up so as not to wake early
+            int ms = -1;
+            if (timeout_set) {
+                ms = static_cast<int>(timeout.tv_sec * 1000 + (timeout.tv_nsec + 999999) / 1000000);
+            }
+            n = epoll_wait(epoll_fd, events, EVENT_BATCH, ms);
+        }
+        if (block) {
+            worker_park_end();
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        dispatch(events[i].data.fd, events[i].events);
+    }
+    if (uring_inflight != 0) {
+        uring_reap();
+    }
+    if (offload_has_done()) {
+        offload_reap();
+    }
+    if (wake_has_fired()) {
+        wake_reap();
+    }
+
+    timer_wheel_poll();
+}
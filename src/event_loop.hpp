@@ -0,0 +1,91 @@
+#ifndef MICROFIBER_EVENT_LOOP_H
+#define MICROFIBER_EVENT_LOOP_H
+
+#include <atomic>
+#include <cstdint>
+#include "uring.hpp"
+#include "offload.hpp"
+#include "wake.hpp"
+
+class Thread;
+
+// The reactor. A file descriptor is added to an epoll instance, edge-triggered and switched to non-blocking mode, the
+// first time a thread waits on it, and stays there until io_close. A thread that finds the fd not ready parks on the
+// fd's wait queue for the direction it needs; every edge epoll reports wakes that queue. When no thread can run, the
+// process blocks in epoll until an fd becomes ready or the earliest sleep timer is due, so a runtime whose threads all
+// wait uses no CPU. While other threads run, epoll is checked every EVENT_POLL_INTERVAL scheduling decisions, or
+// whenever the ready queue runs empty. Queued io_uring operations are submitted at the same points, so the operations
+// of all the threads that blocked in between go to the kernel together. Offloaded jobs that finished are collected
+// there as well, and so are the wake handles fired from outside the runtime.
+//
+// Any worker may check epoll and wake the waiters of an fd. The table of fds is found without a lock, and each wait
+// queue of an fd has its wait lock, under which a thread parks only if no edge was dispatched since it last tried the
+// fd.
+
+// Number of threads waiting for an fd
+extern std::atomic<unsigned long> io_waiter_count;
+
+// Scheduling decisions of the calling worker since it last checked epoll
+extern thread_local unsigned event_poll_skipped;
+
+// Scheduling decisions between two non-blocking checks for I/O readiness while threads are ready to run
+constexpr unsigned EVENT_POLL_INTERVAL = 64;
+
+// Create the epoll instance
+void event_loop_init();
+
+// Close the epoll instance and forget every fd
+void event_loop_end();
+
+// Make sure fd is in the epoll set. Returns 1 if it is, 0 if the fd cannot be polled and is always ready (a regular
+// file), or -1 with errno set if it is not a valid fd.
+int event_loop_register(int fd);
+
+// Add fd, which turns readable when the runtime has work to collect, to the epoll set so it ends the idle wait. Its
+// events wake no thread, the caller collects the work after every wait.
+void event_loop_watch(int fd);
+
+// Number of edges reported for fd so far. A thread that tried the fd with preemption enabled compares it with the count
+// taken before the attempt: a change means an edge came in between, which it would miss by parking.
+unsigned event_loop_edges(int fd);
+
+// Queue thread, which holds its own lock, on the queue of the registered fd for events (POLLIN, POLLOUT or both),
+// unless the fd's edge count is no longer edges. Returns whether it was queued.
+bool event_loop_add(Thread *thread, int fd, short events, unsigned edges);
+
+// Drop the fd wait of thread, if any, once it is off the fd's queue, called by thread_unwait. The wait ends with the
+// events that claimed the thread, or 0.
+void event_loop_cancel(Thread *thread);
+
+// Wake every thread waiting on fd with POLLNVAL and drop the fd from the epoll set, before it is closed
+void event_loop_forget(int fd);
+
+// Make the threads whose fd is ready, or whose timer is due, ready to run. With block set, and nothing ready, first
+// wait in the kernel until something is; the preemption timer is stopped meanwhile, as there is nothing to preempt.
+void event_loop_wait(bool block);
+
+// Whether any thread is waiting for an fd, an io_uring operation, an offloaded job or a wake handle
+inline bool event_loop_pending() {
+    return io_waiter_count != 0 || uring_inflight != 0 || offload_inflight != 0 || wake_waiting != 0;
+}
+
+// Collect io_uring completions, finished offloaded jobs and fired wake handles, which needs no system call to find, and
+// check for I/O readiness once every EVENT_POLL_INTERVAL calls. Costs a single test when no thread waits for I/O.
+inline void event_loop_poll() {
+    if (event_loop_pending()) {
+        if (uring_inflight != 0) {
+            uring_reap();
+        }
+        if (offload_has_done()) {
+            offload_reap();
+        }
+        if (wake_has_fired()) {
+            wake_reap();
+        }
+        if (++event_poll_skipped >= EVENT_POLL_INTERVAL) {
+            event_loop_wait(false);
+        }
+    }
+}
+
+#endif //MICROFIBER_EVENT_LOOP_H
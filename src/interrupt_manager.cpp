@@ -1,68 +1,197 @@
 #include <bits/types/siginfo_t.h>
 #include "interrupt_manager.hpp"
 #include "microfiber.hpp"
+#include "timer_wheel.hpp"
+#include "event_loop.hpp"
+#include "worker.hpp"
 #include <cassert>
 #include <csignal>
 #include <sys/time.h>
+#include <ctime>
 #include <cstdarg>
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
 
 static int init = 0;
 
-// Set the interval for the timer to trigger the interrupt
-static void set_interrupt() {
-    int ret;
-    struct itimerval val{};
+// Whether preemption is allowed on this worker. This lives in memory rather than in the signal mask, so that masking
+// and unmasking preemption around the runtime's critical sections never makes a system call. It only keeps the running
+// thread on its worker: what workers share is guarded by locks of its own.
+static thread_local volatile sig_atomic_t interrupts_enabled = 0;
+
+// Set by the handler when a tick arrives while preemption is disabled, the yield happens once it is enabled again
+static thread_local volatile sig_atomic_t preempt_pending = 0;
 
-    val.it_interval.tv_sec = 0;
-    val.it_interval.tv_usec = 0;
+// Each worker has a periodic preemption timer on CLOCK_MONOTONIC, so that it is not affected by changes to the wall
+// clock. A timer runs only while another thread is ready on its worker: it is disarmed by a tick that finds none and
+// armed again by the next enqueue, so a lone thread is not interrupted for nothing.
+static unsigned quantum = 0;
 
-    val.it_value.tv_sec = 0;
-    val.it_value.tv_usec = INTERRUPT_INTERVAL;
+// Lock-free, so the handler can update them while the program reads them
+static std::atomic<unsigned long> ticks(0);
+static std::atomic<unsigned long> overruns(0);
+static std::atomic<unsigned long> preemptions(0);
+static std::atomic<unsigned long> deferred(0);
+static std::atomic<unsigned long> coalesced(0);
+static std::atomic<unsigned long> disarms(0);
+
+// Arm the timer of worker to fire every quantum_us microseconds, or disarm it when quantum_us is 0
+static void set_interrupt(Worker *worker, unsigned quantum_us) {
+    int ret;
+    struct itimerspec val{};
 
-    ret = setitimer(ITIMER_REAL, &val, nullptr);
+    val.it_interval.tv_sec = quantum_us / 1000000;
+    val.it_interval.tv_nsec = static_cast<long>(quantum_us % 1000000) * 1000;
+    val.it_value = val.it_interval;
+
+    ret = timer_settime(worker->preempt_timer, 0, &val, nullptr);
     assert(!ret);
+    (void) ret;
+}
+
+// Yield on behalf of a tick. If no other thread was ready, no thread waits on a timer or an fd and none is on its way
+// from another worker, the timer is stopped until thread_ready arms it again.
+// Runs with preemption disabled, so no local enqueue can slip in between the failed dequeue and the disarm, and
+// timer_disarm arms the timer again for a thread another worker pushed meanwhile.
+static void preempt() {
+    ThreadID ret = MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    if (ret == static_cast<ThreadID>(MicroFiber::ThreadCodes::NONE) && !timer_wheel_pending() &&
+        !event_loop_pending() && !worker_expects_remote()) {
+        InterruptManager::timer_disarm();
+    }
 }
 
 // This function is called when the signal is received
 static void interrupt_handler(int sig, siginfo_t *sip, void *contextVP) {
     (void) sig;
-    (void) sip;
     (void) contextVP;
 
-    assert(!MicroFiber::is_interrupt_enabled());
+    // Signals from elsewhere, e.g. kill(1), are not ticks
+    if (sip->si_code != SI_TIMER) {
+        return;
+    }
+
+    int saved_errno = errno;
+    ticks.fetch_add(1, std::memory_order_relaxed);
 
-    set_interrupt();
-    MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    // Expirations that happened while this signal was pending are merged into it by the kernel
+    int missed = timer_getoverrun(this_worker->preempt_timer);
+    if (missed > 0) {
+        overruns.fetch_add(missed, std::memory_order_relaxed);
+    }
+
+    if (!interrupts_enabled) {
+        // Inside a critical section, defer the yield until the section ends
+        if (preempt_pending) {
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            deferred.fetch_add(1, std::memory_order_relaxed);
+        }
+        preempt_pending = 1;
+    } else {
+        int enabled = InterruptManager::interrupt_off();
+        preempt_pending = 0;
+        preemptions.fetch_add(1, std::memory_order_relaxed);
+        preempt();
+        InterruptManager::interrupt_set(enabled);
+    }
+    errno = saved_errno;
 }
 
-void InterruptManager::interrupt_init() {
+void InterruptManager::interrupt_init(unsigned quantum_us) {
     struct sigaction action;
     int error;
 
     assert(!init);
+    assert(quantum_us > 0);
     init = 1;
     action.sa_handler = nullptr;
     action.sa_sigaction = interrupt_handler;
     error = sigemptyset(&action.sa_mask);
     assert(!error);
 
-    // Use SA_SIGINFO to get the signal number and context in the handler
-    action.sa_flags = SA_SIGINFO;
+    // Use SA_SIGINFO to get the signal number and context in the handler. The handler may switch to another thread
+    // without returning, so the signal must not stay blocked by the kernel while it runs (SA_NODEFER); re-entry is
+    // prevented by interrupts_enabled instead.
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
     if (sigaction(SIG_TYPE, &action, nullptr)) {
         perror("Setting up signal handler");
         assert(0);
     }
 
-    // Block the signal while the handler is running to avoid re-entry
+    ticks = 0;
+    overruns = 0;
+    preemptions = 0;
+    deferred = 0;
+    coalesced = 0;
+    disarms = 0;
+
+    // Keep preemption off until microfiber_start is done. The timer starts once a second thread becomes ready.
     interrupt_off();
-    set_interrupt();
+    quantum = quantum_us;
+    worker_timer_init();
+}
+
+void InterruptManager::worker_timer_init() {
+    struct sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIG_TYPE;
+    // glibc has no name for the target thread field
+    event._sigev_un._tid = gettid();
+    if (timer_create(CLOCK_MONOTONIC, &event, &this_worker->preempt_timer)) {
+        perror("Creating preemption timer");
+        assert(0);
+    }
+    this_worker->timer_armed.store(false);
+    this_worker->has_timer.store(true);
+}
+
+void InterruptManager::worker_timer_end() {
+    if (this_worker->has_timer) {
+        this_worker->has_timer.store(false);
+        this_worker->timer_armed.store(false);
+        timer_delete(this_worker->preempt_timer);
+    }
 }
 
 void InterruptManager::interrupt_end() {
+    if (init) {
+        worker_timer_end();
+    }
     signal(SIG_TYPE, SIG_IGN);
     init = 0;
 }
 
+void InterruptManager::timer_arm() {
+    timer_arm(this_worker);
+}
+
+// Other workers arm the timer of a worker they push a thread to, so only the one that sets the flag starts it
+void InterruptManager::timer_arm(Worker *worker) {
+    if (!init || !worker->has_timer.load(std::memory_order_relaxed) ||
+        worker->timer_armed.load(std::memory_order_relaxed) || worker->timer_armed.exchange(true)) {
+        return;
+    }
+    set_interrupt(worker, quantum);
+}
+
+// A worker pushing a thread here counts it in incoming before it tries to arm the timer. Either it finds the flag
+// cleared, after the timer was stopped, and starts it again, or the count is seen here and the timer restarted.
+void InterruptManager::timer_disarm() {
+    Worker *worker = this_worker;
+    if (!init || !worker->has_timer.load(std::memory_order_relaxed) ||
+        !worker->timer_armed.load(std::memory_order_relaxed)) {
+        return;
+    }
+    set_interrupt(worker, 0);
+    worker->timer_armed.store(false);
+    disarms.fetch_add(1, std::memory_order_relaxed);
+    if (multi_worker() && worker->incoming.load() != 0 && !worker->timer_armed.exchange(true)) {
+        set_interrupt(worker, quantum);
+    }
+}
+
 int InterruptManager::interrupt_on() {
     return interrupt_set(1);
 }
@@ -71,38 +200,57 @@ int InterruptManager::interrupt_off() {
     return interrupt_set(0);
 }
 
-static void set_signal(sigset_t *setp) {
-    int ret;
-    ret = sigemptyset(setp);
-    assert(!ret);
-    ret = sigaddset(setp, SIG_TYPE);
-    assert(!ret);
-}
-
 int InterruptManager::interrupt_set(int enabled) {
-    int ret;
-    sigset_t mask, omask;
+    int old = interrupts_enabled;
 
-    set_signal(&mask);
-    if (enabled) {
-        ret = sigprocmask(SIG_UNBLOCK, &mask, &omask);
-    } else {
-        ret = sigprocmask(SIG_BLOCK, &mask, &omask);
+    // Keep the compiler from moving memory accesses of the critical section across the flag update
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (!enabled) {
+        interrupts_enabled = 0;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        return old;
     }
-    assert(!ret);
-    return (sigismember(&omask, SIG_TYPE) ? 0 : 1);
+    if (old) {
+        return old;
+    }
+
+    while (true) {
+        // Take the preemption that was deferred while the critical section ran
+        while (preempt_pending) {
+            preempt_pending = 0;
+            preempt();
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+        interrupts_enabled = 1;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+
+        // A tick that arrived in between was deferred
+        if (!preempt_pending) {
+            break;
+        }
+        interrupts_enabled = 0;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    return old;
 }
 
-bool MicroFiber::is_interrupt_enabled() {
-    sigset_t mask;
-    int ret;
+PreemptStats MicroFiber::get_preempt_stats() {
+    PreemptStats ret{};
 
+    ret.ticks = ticks.load(std::memory_order_relaxed);
+    ret.overruns = overruns.load(std::memory_order_relaxed);
+    ret.preemptions = preemptions.load(std::memory_order_relaxed);
+    ret.deferred = deferred.load(std::memory_order_relaxed);
+    ret.coalesced = coalesced.load(std::memory_order_relaxed);
+    ret.disarms = disarms.load(std::memory_order_relaxed);
+    return ret;
+}
+
+bool MicroFiber::is_interrupt_enabled() {
     if (!init)
         return false;
 
-    ret = sigprocmask(0, nullptr, &mask);
-    assert(!ret);
-    return (sigismember(&mask, SIG_TYPE) ? 0 : 1);
+    return interrupts_enabled;
 }
 
 void MicroFiber::spin_wait(int microseconds) {
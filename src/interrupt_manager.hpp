@@ -3,9 +3,11 @@
 
 #define SIG_TYPE SIGALRM
 
+struct Worker;
+
 class InterruptManager {
 public:
-    static void interrupt_init();
+    static void interrupt_init(unsigned quantum_us);
 
     static void interrupt_end();
 
@@ -14,6 +16,20 @@ public:
     static int interrupt_off();
 
     static int interrupt_set(int enabled);
+
+    // Create and delete the preemption timer of the calling worker, which only signals that worker's system thread
+    static void worker_timer_init();
+
+    static void worker_timer_end();
+
+    // Start the preemption timer if it was stopped for lack of competition, called whenever a thread becomes ready
+    static void timer_arm();
+
+    // Likewise for the timer of another worker
+    static void timer_arm(Worker *worker);
+
+    // Stop the preemption timer of the calling worker, until the next call to timer_arm
+    static void timer_disarm();
 };
 
 
@@ -1,6 +1,14 @@
 #include "microfiber.hpp"
 #include "interrupt_manager.hpp"
 #include "thread_manager.hpp"
+#include "stack_pool.hpp"
+#include "timer_wheel.hpp"
+#include "event_loop.hpp"
+#include "uring.hpp"
+#include "offload.hpp"
+#include "wake.hpp"
+#include "parking_lot.hpp"
+#include "worker.hpp"
 #include "schedulers/scheduler.hpp"
 
 #include <cstdlib>
@@ -21,19 +29,39 @@ static volatile bool called = false;
 static void MicroFiber_end() {
     assert(!MicroFiber::is_interrupt_enabled());
     InterruptManager::interrupt_end();
+    worker_end();
+    offload_end();
+    wake_end();
+    event_loop_end();
+    uring_end();
+    timer_wheel_end();
+    parking_lot_end();
     thread_end();
+    stack_pool_end();
     scheduler_end();
     exit(exit_status);
 }
 
 // Start the MicroFiber threading system with the provided configuration
 void MicroFiber::microfiber_start(const Config *config) {
-    // Initialize random seed
-    srand(0);
-    scheduler_init(config->scheduler_name);
-    thread_init();
+    scheduler_init(config);
+    runtime_start(config);
+}
+
+void runtime_start(const Config *config) {
+    stack_pool_init(config->stack_pool_high_water ? config->stack_pool_high_water : STACK_POOL_HIGH_WATER);
+    worker_init(config);
+    thread_init(config->max_threads);
+    parking_lot_init(config->max_threads);
+    timer_wheel_init();
+    if (config->use_io_uring)
+        uring_init(URING_ENTRIES);
+    event_loop_init();
+    wake_init();
+    offload_init(config->offload_threads ? config->offload_threads : OFFLOAD_THREADS);
     if (config->is_preemptive)
-        InterruptManager::interrupt_init();
+        InterruptManager::interrupt_init(config->preempt_quantum_us ? config->preempt_quantum_us : INTERRUPT_INTERVAL);
+    worker_start();
 
     // Ensure interrupt is off
     assert(!MicroFiber::is_interrupt_enabled());
@@ -52,6 +80,10 @@ void MicroFiber::microfiber_start(const Config *config) {
 
 // Cleans up resources and exits the process with the provided exit code
 [[noreturn]] void MicroFiber::microfiber_exit(int code) {
+    runtime_exit(code);
+}
+
+void runtime_exit(int code) {
     assert(!MicroFiber::is_interrupt_enabled());
     exit_status = code;
 
@@ -1,17 +1,48 @@
 #ifndef MICROFIBER_HPP
 #define MICROFIBER_HPP
 
+#include <atomic>
 #include <string>
 #include <memory>
 #include <functional>
+#include <cstdint>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
 
-/* Maximum number of threads */
+/* A cap on live threads for programs that want one, through Config::max_threads; by default there is none */
 constexpr int MAX_THREAD_COUNT = 1024;
 
-/* Minimum per-thread stack size */
+/* Minimum and default per-thread stack size */
 constexpr int MIN_STACK_SIZE = 32768;
 
-/* Interval for preemptive thread interrupts in microseconds */
+/* The Prio scheduler keeps a FIFO level for each priority in [PRIO_LEVEL_MIN, PRIO_LEVEL_MIN + PRIO_LEVELS) and finds
+ * the first non-empty one in constant time. Every other priority keeps its order too, in a sorted queue ahead of or
+ * behind the levels, where an insertion walks the threads queued there. */
+constexpr int PRIO_LEVELS = 256;
+constexpr int PRIO_LEVEL_MIN = -64;
+
+/* Lottery tickets held by a thread of priority 0, each priority number above 0 holds one ticket less (at least one) */
+constexpr int LOTTERY_TICKETS = 100;
+
+/* Number of lottery tickets held by a thread of the given priority */
+constexpr unsigned long lottery_tickets(int prio) {
+    return prio < 0 ? LOTTERY_TICKETS : prio >= LOTTERY_TICKETS - 1 ? 1 : LOTTERY_TICKETS - prio;
+}
+
+/* Default upper bound in bytes on idle stacks kept for reuse by the stack pool */
+constexpr size_t STACK_POOL_HIGH_WATER = 4 * 1024 * 1024;
+
+/* Resolution of timed sleeps in microseconds, deadlines are rounded up to a multiple of it */
+constexpr int TIMER_TICK_US = 100;
+
+/* Size of the io_uring submission queue */
+constexpr unsigned URING_ENTRIES = 256;
+
+/* Default number of system threads running offloaded calls */
+constexpr unsigned OFFLOAD_THREADS = 4;
+
+/* Default preemption quantum in microseconds */
 constexpr int INTERRUPT_INTERVAL = 200;
 
 /* Forward declaration */
@@ -23,11 +54,95 @@ using ThreadID = int;
 /* Configuration for MicroFiber initialization */
 struct Config {
     enum class SchedulerType {
-        Random, FCFS, Prio
+        Random, FCFS, Prio, Lottery, WorkStealing
     };
 
     SchedulerType scheduler_name;
     bool is_preemptive;
+
+    /* Maximum number of live threads, 0 for no limit but memory and the range of ThreadID */
+    unsigned max_threads;
+
+    /* Upper bound in bytes on idle stacks kept for reuse, 0 selects STACK_POOL_HIGH_WATER */
+    size_t stack_pool_high_water;
+
+    /* Seed of the private generator of the Random and Lottery schedulers */
+    uint64_t scheduler_seed;
+
+    /* Preemption quantum in microseconds, 0 selects INTERRUPT_INTERVAL */
+    unsigned preempt_quantum_us;
+
+    /* Run io_read, io_write, io_pread, io_pwrite, io_fsync and io_accept through io_uring, if the kernel allows it */
+    bool use_io_uring;
+
+    /* Number of system threads running offloaded calls, 0 selects OFFLOAD_THREADS */
+    unsigned offload_threads;
+
+    /* Number of system threads running fibers, each from its own run queue. 0 or 1 runs every fiber on the thread
+     * that called microfiber_start. */
+    unsigned workers;
+
+    /* Pin worker i to the i-th CPU the process may run on, wrapping around, and place the stacks and records of the
+     * threads a worker creates on its NUMA node. WorkStealing then steals from workers sharing a last-level cache
+     * first, and crosses NUMA nodes last. */
+    bool pin_workers;
+};
+
+/* Optional per-thread attributes for thread_create */
+struct ThreadAttr {
+    /* Usable stack size in bytes, rounded up to whole pages. 0 selects MIN_STACK_SIZE. Stack pages are committed
+     * lazily, so a large stack only costs virtual address space until the thread actually uses it. */
+    size_t stack_size;
+};
+
+/* Counters of the stack pool, used to size its high-water mark */
+struct StackPoolStats {
+    unsigned long hits;         // stacks reused from the pool
+    unsigned long misses;       // stacks allocated from the system
+    unsigned long trims;        // stacks returned to the system because the pool was full
+    unsigned long idle_stacks;  // stacks currently idle in the pool
+    size_t idle_bytes;          // bytes currently idle in the pool
+};
+
+/* Counters of the preemption timer, used to tune the quantum */
+struct PreemptStats {
+    unsigned long ticks;        // timer signals delivered
+    unsigned long overruns;     // expirations missed because the previous signal was still pending
+    unsigned long preemptions;  // ticks that switched threads right away
+    unsigned long deferred;     // ticks that arrived with preemption disabled and were taken when it was re-enabled
+    unsigned long coalesced;    // ticks that arrived while a deferred preemption was already pending
+    unsigned long disarms;      // times the timer was stopped because no other thread was ready to run
+};
+
+/* Counters of the io_uring backend, to check how well submissions are batched */
+struct UringStats {
+    bool enabled;               // whether io_uring is in use
+    unsigned long submissions;  // operations submitted
+    unsigned long enters;       // io_uring_enter calls that submitted them
+};
+
+/* Counters of the WorkStealing scheduler, summed over the workers */
+struct StealStats {
+    unsigned long steals;       // threads a worker took from another worker's deque
+    unsigned long failed;       // times a worker out of threads found nothing to take from the others
+};
+
+/* Where a worker runs and how far the threads it stole came from */
+struct WorkerStats {
+    int cpu;                            // CPU the worker is pinned to, -1 unless Config::pin_workers is set
+    int node;                           // NUMA node of that CPU, 0 when not pinned
+    unsigned long steals;               // threads taken from other workers
+    unsigned long steals_same_cache;    // of those, from a worker sharing this worker's last-level cache
+    unsigned long steals_remote_node;   // of those, from a worker on another NUMA node
+    unsigned long remote_stacks;        // stolen threads whose stack and record are on another NUMA node
+};
+
+/* The counters of WorkerStats summed over the workers of a NUMA node */
+struct NodeStats {
+    unsigned workers;                   // workers pinned to a CPU of the node
+    unsigned long steals;
+    unsigned long steals_remote_node;
+    unsigned long remote_stacks;
 };
 
 
@@ -52,9 +167,18 @@ public:
     /* Get the identifier of the currently running thread */
     static ThreadID get_thread_id();
 
-    /* Create a thread to run the function fn(arg) with the given priority */
+    /* Get the index of the worker running the current thread, always 0 unless Config::workers is above 1 */
+    static unsigned get_worker_id();
+
+    /* Create a thread to run the function fn(arg) with the given priority. Returns the new thread's ID, or MAX_THREADS
+     * if Config::max_threads threads are alive, or NO_MEMORY if no thread record can be allocated. The stack is only
+     * mapped when the thread first runs, so a stack that cannot be mapped is not reported here: the thread then exits
+     * right away with NO_MEMORY, which only thread_wait reports, as the thread's exit code. */
     static ThreadID thread_create(const ThreadFunction &fn, void *arg, int priority);
 
+    /* Create a thread as above, with the attributes given in attr (which may be null) */
+    static ThreadID thread_create(const ThreadFunction &fn, void *arg, int priority, const ThreadAttr *attr);
+
     /* Exit the current thread, releasing resources and switching to another thread if available */
     [[noreturn]]  static void thread_exit(int exit_code);
 
@@ -76,6 +200,58 @@ public:
     /* Suspend the current thread, adding it to a wait queue, and switch to another thread */
     static ThreadID thread_sleep(FifoQueue *queue);
 
+    /* Suspend the current thread for at least the given number of microseconds, letting other threads run */
+    static void thread_sleep_for(uint64_t microseconds);
+
+    /* Suspend the current thread until get_time_us() reaches deadline_us, letting other threads run */
+    static void thread_sleep_until(uint64_t deadline_us);
+
+    /* Suspend the current thread until fd is ready for the given events (POLLIN and/or POLLOUT), letting other
+     * threads run. Returns the events that occurred, as poll reports them, or INVALID if fd cannot be waited on. */
+    static int thread_wait_io(int fd, short events);
+
+    /* Fiber-blocking I/O: when the call would block, only the calling thread waits while the others run. The fd is
+     * switched to non-blocking mode on first use and must then be closed with io_close. Return values and errno are
+     * those of the system calls. */
+    static ssize_t io_read(int fd, void *buf, size_t count);
+
+    /* Write all count bytes unless an error occurs first */
+    static ssize_t io_write(int fd, const void *buf, size_t count);
+
+    /* Accept a connection, the new socket is non-blocking */
+    static int io_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+    static int io_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+    /* Like poll, letting other threads run while none of the fds is ready. The fds are neither registered nor switched
+     * to non-blocking mode, and with nfds 0 the call sleeps for timeout_ms. */
+    static int io_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms);
+
+    /* Wake the threads waiting on fd, which fail with EBADF, and close it */
+    static int io_close(int fd);
+
+    /* Read or write at offset, or at the file position if offset is -1. With Config::use_io_uring these, io_fsync,
+     * io_read, io_write and io_accept are completion-based: the operation is queued on the ring and the thread parks
+     * until it completes. Without it they fall back to the readiness-based calls above, or to the plain system call
+     * for regular files; io_fsync then runs on the offload pool. */
+    static ssize_t io_pread(int fd, void *buf, size_t count, off_t offset);
+
+    static ssize_t io_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+    static int io_fsync(int fd);
+
+    /* Run fn(arg) on a system thread of the offload pool while the calling thread waits and the others run, for
+     * blocking calls with no fiber-blocking counterpart such as getaddrinfo or stat. fn runs outside the runtime and
+     * must not call into MicroFiber. Returns what fn returns, with errno as fn left it. The pool is started by the
+     * first call; if it cannot be, fn runs right away on the calling thread. */
+    static int offload(const ThreadFunction &fn, void *arg);
+
+    /* Get the io_uring submission counters */
+    static UringStats get_uring_stats();
+
+    /* Get the current time of the monotonic clock used by thread_sleep_until, in microseconds */
+    static uint64_t get_time_us();
+
     /* Wake up threads from the wait queue and add them to the ready queue */
     static int thread_wakeup(FifoQueue *queue, bool wake_all);
 
@@ -85,6 +261,24 @@ public:
     /* Set the priority of the current thread */
     static void set_thread_priority(int priority);
 
+    /* Get the hit, miss and trim counters of the stack pool */
+    static StackPoolStats get_stack_pool_stats();
+
+    /* Get the tick, overrun and deferral counters of the preemption timer */
+    static PreemptStats get_preempt_stats();
+
+    /* Get the steal counters of the WorkStealing scheduler */
+    static StealStats get_steal_stats();
+
+    /* Get the placement and steal counters of a worker, all zero and cpu -1 for an id past the last worker */
+    static WorkerStats get_worker_stats(unsigned worker);
+
+    /* Get the steal counters of the workers of a NUMA node, node numbers run from 0 to get_node_count() - 1 */
+    static NodeStats get_node_stats(int node);
+
+    /* Get the number of NUMA nodes, 1 unless Config::pin_workers is set on a NUMA machine */
+    static int get_node_count();
+
 private:
     /* Exit MicroFiber, cleaning up resources and exiting the process */
     [[noreturn]] static void microfiber_exit(int code);
@@ -93,22 +287,127 @@ private:
 
 struct Thread;
 
+/* A mutual exclusion lock. It is a single word, holding the ID of the thread that owns it, and allocates nothing: the
+ * threads waiting for it are kept in the runtime's parking lot, keyed by the lock's address, so locks can be embedded
+ * in data structures by the million. Taking and releasing a lock no other thread wants is one atomic operation each.
+ * Only the owner may release a lock. */
 class Lock {
 public:
-    Lock();
+    constexpr Lock() : word(0) {}
 
     ~Lock();
 
+    Lock(const Lock &) = delete;
+
+    Lock &operator=(const Lock &) = delete;
+
     // Acquire a lock, blocking the calling thread if necessary
     void acquire();
 
-    // Release a lock, allowing waiting threads to acquire it
+    // Acquire the lock if it is free, returns whether it was
+    bool try_acquire();
+
+    // Release a lock, allowing waiting threads to acquire it. The calling thread must own it.
+    void release();
+
+private:
+    friend class Condition;
+
+    static constexpr uint32_t PARKED = 1;   // threads may be parked on the lock
+
+    // The word of a lock owned by the calling thread, without PARKED
+    static uint32_t owned_word();
+
+    void acquire_slow();
+
+    // Release the lock with interrupts disabled, without yielding. Returns whether a waiting thread was made ready.
+    bool release_locked();
+
+    std::atomic<uint32_t> word;             // the owner's ID plus one, shifted left by one, or 0; and PARKED
+};
+
+/* A condition variable used with a Lock. A single byte, its waiting threads are kept in the parking lot. */
+class Condition {
+public:
+    constexpr Condition() : waiters(false) {}
+
+    Condition(const Condition &) = delete;
+
+    Condition &operator=(const Condition &) = delete;
+
+    // Release lock, which the calling thread holds, block until notified, and acquire lock again. As wakeups may
+    // come from elsewhere (a thread that took the lock in between may have consumed what was notified) the caller
+    // checks its condition again in a loop.
+    void wait(Lock &lock);
+
+    // Wake the thread that waited first, if any
+    void notify_one();
+
+    // Wake every waiting thread
+    void notify_all();
+
+private:
+    std::atomic<bool> waiters;  // threads may be waiting
+};
+
+/* A counting semaphore. A single word, its waiting threads are kept in the parking lot. */
+class Semaphore {
+public:
+    constexpr explicit Semaphore(unsigned count) : word(count << 1) {}
+
+    Semaphore(const Semaphore &) = delete;
+
+    Semaphore &operator=(const Semaphore &) = delete;
+
+    // Take one unit, blocking the calling thread until one is available
+    void acquire();
+
+    // Take one unit if one is available, returns whether one was
+    bool try_acquire();
+
+    // Give back one unit, waking a waiting thread if any
     void release();
 
 private:
-    int flag;
-    Thread *owner;
-    FifoQueue *wait_queue;
+    static constexpr unsigned PARKED = 1;   // threads may be parked on the semaphore
+
+    std::atomic<unsigned> word;             // available units shifted left by one, or PARKED
+};
+
+/* Lets code outside the runtime wake a thread: a system thread the runtime did not start, such as the callback thread
+ * of a client library, or a signal handler. One thread at a time waits on a handle until another party fires it.
+ *
+ * A handle is destroyed by a MicroFiber thread, or after the runtime has ended, once no thread waits on it and no fire
+ * can start on it any more. Fires that have already started, even one whose wait has returned, are waited out, so a
+ * thread may destroy the handle it waited on as soon as the wait returns. */
+class WakeHandle {
+public:
+    WakeHandle();
+
+    ~WakeHandle();
+
+    WakeHandle(const WakeHandle &) = delete;
+
+    WakeHandle &operator=(const WakeHandle &) = delete;
+
+    // Block the calling thread until the handle is fired. Returns 0, right away if the handle was fired since the last
+    // wait returned, or INVALID if another thread is already waiting on it.
+    int wait();
+
+    // Wake the thread waiting on the handle, or let the next wait return right away. Fires before that wait count
+    // once. May be called from any system thread and from a signal handler.
+    void fire();
+
+private:
+    friend unsigned wake_reap();
+    friend void wake_cancel(Thread *thread);
+    friend void wake_end();
+
+    std::atomic<bool> fired;
+    std::atomic<bool> queued;       // whether the handle is on the runtime's stack of fired handles
+    std::atomic<unsigned> firing;   // fires that may still touch the handle
+    Thread *waiter;
+    WakeHandle *next;               // next handle on that stack
 };
 
 #endif // MICROFIBER_HPP
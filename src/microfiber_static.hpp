@@ -0,0 +1,62 @@
+#ifndef MICROFIBER_STATIC_HPP
+#define MICROFIBER_STATIC_HPP
+
+#include <cassert>
+#include "microfiber.hpp"
+#include "thread_ops.hpp"
+#include "schedulers/scheduler.hpp"
+
+/* MicroFiber with the scheduling policy (FCFSPolicy, RandPolicy, PrioPolicy or LotteryPolicy) fixed at compile time.
+ * The run-queue operations of thread_create, thread_yield, thread_sleep, thread_sleep_until, thread_wait_io and
+ * thread_wakeup are called directly instead of through the virtual Scheduler, so the compiler can inline them.
+ * Config::scheduler_name is ignored.
+ *
+ * The runtime is shared with MicroFiber: the remaining calls, preemption and Lock go through the MicroFiber API and
+ * reach the same run queue through a PolicyScheduler adapter. Only one of the two may be started in a process, and
+ * the policy instance is a single run queue, so Config::workers must be 0 or 1. */
+template<class Policy>
+class StaticMicroFiber {
+public:
+    /* Initialize MicroFiber with this policy */
+    static void microfiber_start(const Config *config) {
+        assert(config->workers <= 1);
+        scheduler_init(&adapter, config);
+        runtime_start(config);
+    }
+
+    /* Create a thread to run the function fn(arg) with the given priority and optional attributes */
+    static ThreadID thread_create(const MicroFiber::ThreadFunction &fn, void *arg, int priority,
+                                  const ThreadAttr *attr = nullptr) {
+        return thread_create_with(adapter.get_policy(), fn, arg, priority, attr);
+    }
+
+    /* Yield execution to a specified thread or the next available thread in the queue */
+    static ThreadID thread_yield(ThreadID tid) {
+        return thread_yield_with(adapter.get_policy(), tid);
+    }
+
+    /* Suspend the current thread, adding it to a wait queue, and switch to another thread */
+    static ThreadID thread_sleep(FifoQueue *queue) {
+        return thread_sleep_with(adapter.get_policy(), queue);
+    }
+
+    /* Suspend the current thread until MicroFiber::get_time_us() reaches deadline_us */
+    static void thread_sleep_until(uint64_t deadline_us) {
+        thread_sleep_until_with(adapter.get_policy(), deadline_us);
+    }
+
+    /* Suspend the current thread until fd is ready for the given events */
+    static int thread_wait_io(int fd, short events) {
+        return thread_wait_io_with(adapter.get_policy(), fd, events);
+    }
+
+    /* Wake up threads from the wait queue and add them to the ready queue */
+    static int thread_wakeup(FifoQueue *queue, bool wake_all) {
+        return thread_wakeup_with(adapter.get_policy(), queue, wake_all);
+    }
+
+private:
+    static inline PolicyScheduler<Policy> adapter;
+};
+
+#endif // MICROFIBER_STATIC_HPP
@@ -0,0 +1,219 @@
+#include "offload.hpp"
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "thread_manager.hpp"
+#include "event_loop.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+#include "topology.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <system_error>
+#include <cstdint>
+#include <mutex>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+std::atomic<unsigned long> offload_inflight(0);
+std::atomic<OffloadJob *> offload_done(nullptr);
+
+static unsigned pool_size = OFFLOAD_THREADS;
+static std::vector<std::thread> pool_threads;
+
+// Whether the pool is up, set once under pool_mutex by the first offload of any runtime worker
+static std::atomic<bool> pool_started(false);
+
+// Signals the runtime when the completion stack turns non-empty
+static int kick_fd = -1;
+
+// Jobs not picked up by a worker yet, oldest first, the stop request and the pool threads, guarded by pool_mutex
+static std::mutex pool_mutex;
+static std::condition_variable pool_cond;
+static OffloadJob *pending_head = nullptr;
+static OffloadJob *pending_tail = nullptr;
+static bool stopping = false;
+
+static void worker_main() {
+    // Blocking calls may run anywhere, not on the CPU of the pinned worker that started the pool
+    topology_unpin();
+
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    while (true) {
+        pool_cond.wait(lock, [] { return stopping || pending_head != nullptr; });
+        if (stopping) {
+            return;
+        }
+        OffloadJob *job = pending_head;
+        pending_head = job->next;
+        if (pending_head == nullptr) {
+            pending_tail = nullptr;
+        }
+        lock.unlock();
+
+        errno = 0;
+        job->result = job->fn(job->arg);
+        job->error = errno;
+
+        // Only the push onto an empty stack needs a kick, the runtime takes the whole stack at once
+        OffloadJob *head = offload_done.load(std::memory_order_relaxed);
+        do {
+            job->next = head;
+        } while (!offload_done.compare_exchange_weak(head, job, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        if (head == nullptr) {
+            uint64_t one = 1;
+            ssize_t ret = write(kick_fd, &one, sizeof(one));
+            (void) ret;
+        }
+
+        lock.lock();
+    }
+}
+
+// Create the eventfd and the workers. The workers block every signal, so signals sent to the process are always
+// handled by the runtime.
+static bool offload_start() {
+    kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (kick_fd < 0) {
+        return false;
+    }
+    event_loop_watch(kick_fd);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    stopping = false;
+    try {
+        for (unsigned i = 0; i < pool_size; i++) {
+            pool_threads.emplace_back(worker_main);
+        }
+    } catch (const std::system_error &) {
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    if (pool_threads.empty()) {
+        close(kick_fd);
+        kick_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void offload_init(unsigned workers_wanted) {
+    assert(pool_threads.empty());
+    pool_size = workers_wanted;
+    offload_inflight.store(0);
+}
+
+void offload_end() {
+    if (!pool_threads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            stopping = true;
+        }
+        pool_cond.notify_all();
+        for (auto &worker: pool_threads) {
+            worker.join();
+        }
+        pool_threads.clear();
+        pool_started.store(false);
+    }
+    if (kick_fd >= 0) {
+        close(kick_fd);
+        kick_fd = -1;
+    }
+    pending_head = pending_tail = nullptr;
+    offload_done.store(nullptr, std::memory_order_relaxed);
+    offload_inflight.store(0);
+}
+
+bool offload_run(OffloadJob *job) {
+    if (!pool_started.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (!pool_started.load(std::memory_order_relaxed)) {
+            if (!offload_start()) {
+                return false;
+            }
+            pool_started.store(true, std::memory_order_release);
+        }
+    }
+
+    // A killed thread does not start the job, one killed from now on is made ready by the job's completion all the
+    // same, as the job may be using its stack until then
+    Thread *curr = current_thread;
+    Thread::State running = Thread::State::RUNNING;
+    if (!curr->state.compare_exchange_strong(running, Thread::State::IO_BLOCKED)) {
+        MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    }
+    job->thread = curr;
+    job->next = nullptr;
+    curr->offload_pending = true;
+    offload_inflight.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (pending_tail != nullptr) {
+            pending_tail->next = job;
+        } else {
+            pending_head = job;
+        }
+        pending_tail = job;
+    }
+    pool_cond.notify_one();
+
+    thread_block_with(*scheduler);
+    assert(!curr->offload_pending);
+    return true;
+}
+
+unsigned offload_reap() {
+    // Drain the eventfd before taking the stack: a job pushed after the exchange kicks again
+    uint64_t count;
+    ssize_t ret = read(kick_fd, &count, sizeof(count));
+    (void) ret;
+
+    OffloadJob *jobs = offload_done.exchange(nullptr, std::memory_order_acquire);
+
+    // The stack holds the most recent job first, resume the threads in the order their jobs finished
+    OffloadJob *ordered = nullptr;
+    while (jobs != nullptr) {
+        OffloadJob *next = jobs->next;
+        jobs->next = ordered;
+        ordered = jobs;
+        jobs = next;
+    }
+
+    unsigned woken = 0;
+    while (ordered != nullptr) {
+        OffloadJob *next = ordered->next;
+        Thread *thread = ordered->thread;
+        thread->offload_pending = false;
+        offload_inflight.fetch_sub(1, std::memory_order_relaxed);
+        // A thread killed meanwhile is made ready all the same, to exit
+        thread_claim(thread, Thread::State::IO_BLOCKED);
+        thread_ready(*scheduler, thread);
+        woken++;
+        ordered = next;
+    }
+    return woken;
+}
+
+int MicroFiber::offload(const ThreadFunction &fn, void *arg) {
+    int enabled = InterruptManager::interrupt_off();
+
+    OffloadJob job{fn, arg, 0, 0, nullptr, nullptr};
+    if (!offload_run(&job)) {
+        // No worker could be started, so the call blocks every thread as it would have without the pool
+        InterruptManager::interrupt_set(enabled);
+        return fn(arg);
+    }
+
+    InterruptManager::interrupt_set(enabled);
+    errno = job.error;
+    return job.result;
+}
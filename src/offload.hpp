@@ -0,0 +1,47 @@
+#ifndef MICROFIBER_OFFLOAD_H
+#define MICROFIBER_OFFLOAD_H
+
+#include <atomic>
+#include "microfiber.hpp"
+
+class Thread;
+
+// Blocking calls run on a small pool of system threads. The calling thread queues a job, which lives on its own stack,
+// and parks as IO_BLOCKED. A worker runs the job, pushes it on a lock-free completion stack and, if that stack was
+// empty, writes an eventfd the event loop watches; the runtime then makes the threads of the completed jobs ready. The
+// workers are started by the first offload and never touch the scheduler.
+
+struct OffloadJob {
+    MicroFiber::ThreadFunction fn;
+    void *arg;
+    int result;                 // return value of fn
+    int error;                  // errno as fn left it
+    Thread *thread;             // the thread waiting for the job
+    OffloadJob *next;           // next job in the pending queue or the completion stack
+};
+
+// Number of jobs submitted whose thread has not been made ready yet
+extern std::atomic<unsigned long> offload_inflight;
+
+// Jobs the workers have finished, most recent first
+extern std::atomic<OffloadJob *> offload_done;
+
+// Set the number of workers the pool starts with
+void offload_init(unsigned workers);
+
+// Stop the workers, waiting for the jobs they are running, and close the eventfd
+void offload_end();
+
+// Run job on a worker and park the current thread until it is done. Returns false, leaving the thread running, if
+// the pool could not be started. Must be called with interrupts disabled.
+bool offload_run(OffloadJob *job);
+
+// Make the threads of the finished jobs ready, returns how many
+unsigned offload_reap();
+
+// Whether finished jobs wait for offload_reap, checked without a system call
+inline bool offload_has_done() {
+    return offload_done.load(std::memory_order_relaxed) != nullptr;
+}
+
+#endif //MICROFIBER_OFFLOAD_H
@@ -0,0 +1,134 @@
+#include "parking_lot.hpp"
+#include "microfiber.hpp"
+#include "thread_manager.hpp"
+#include "queue.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+
+// Bounds on the number of buckets, a power of two
+constexpr unsigned MIN_BUCKETS_SHIFT = 6;
+constexpr unsigned MAX_BUCKETS_SHIFT = 16;
+
+static std::unique_ptr<FifoQueue[]> buckets;
+static unsigned buckets_shift = 0;
+
+static FifoQueue &bucket_of(const void *addr) {
+    // Fibonacci hashing, the top bits of the product mix in every bit of the address
+    auto key = reinterpret_cast<uintptr_t>(addr);
+    uint64_t hash = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+    return buckets[hash >> (64 - buckets_shift)];
+}
+
+// The thread that parked on addr first after thread, or the first of the bucket if thread is nullptr
+static Thread *parked_after(FifoQueue &bucket, Thread *thread, const void *addr) {
+    Thread *t = thread == nullptr ? bucket.top() : thread->next;
+    while (t != nullptr && t->park_addr != addr) {
+        t = t->next;
+    }
+    return t;
+}
+
+// Take thread off the bucket and keep it to be made ready, unless a killer claimed it first, which takes it off itself
+static bool unpark(FifoQueue &bucket, Thread *thread, WokenList &woken) {
+    if (!thread_claim(thread)) {
+        return false;
+    }
+    bucket.remove(thread);
+    woken.push(thread);
+    return true;
+}
+
+void parking_lot_init(unsigned max_threads) {
+    assert(!buckets);
+    buckets_shift = max_threads != 0 ? MIN_BUCKETS_SHIFT : MAX_BUCKETS_SHIFT;
+    while (buckets_shift < MAX_BUCKETS_SHIFT && (1u << buckets_shift) < max_threads) {
+        buckets_shift++;
+    }
+    buckets.reset(new FifoQueue[1u << buckets_shift]);
+}
+
+void parking_lot_end() {
+    if (!buckets) {
+        return;
+    }
+    for (unsigned i = 0; i < (1u << buckets_shift); i++) {
+        while (buckets[i].pop() != nullptr) {
+        }
+    }
+    buckets.reset();
+}
+
+bool parking_lot_park(const void *addr, bool (*validate)(const void *addr), void (*before_block)(void *arg),
+                      void *arg) {
+    Thread *curr = current_thread;
+    if (!thread_wait_begin()) {
+        // The primitive may expect before_block to run, e.g. a condition variable to release its lock
+        if (before_block != nullptr) {
+            before_block(arg);
+        }
+        MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    }
+    FifoQueue &bucket = bucket_of(addr);
+    WordLock &lock = wait_lock(&bucket);
+    lock.lock();
+    if (!validate(addr)) {
+        lock.unlock();
+        thread_wait_end();
+        thread_block_abort(*scheduler);
+        return false;
+    }
+    curr->park_addr = addr;
+    int ret = bucket.push(curr);
+    assert(ret == 0);
+    (void) ret;
+    lock.unlock();
+    thread_wait_end();
+
+    if (before_block != nullptr) {
+        before_block(arg);
+    }
+    thread_block_with(*scheduler);
+    return true;
+}
+
+bool parking_lot_unpark_one(const void *addr, void (*callback)(const void *addr, bool more_parked)) {
+    FifoQueue &bucket = bucket_of(addr);
+    WordLock &lock = wait_lock(&bucket);
+    WokenList woken;
+    lock.lock();
+    Thread *thread = parked_after(bucket, nullptr, addr);
+    bool unparked = false;
+    while (thread != nullptr && !unparked) {
+        Thread *next = parked_after(bucket, thread, addr);
+        unparked = unpark(bucket, thread, woken);
+        thread = next;
+    }
+    if (callback != nullptr) {
+        callback(addr, thread != nullptr);
+    }
+    lock.unlock();
+    woken.ready(*scheduler);
+    return unparked;
+}
+
+unsigned parking_lot_unpark_all(const void *addr, void (*callback)(const void *addr)) {
+    FifoQueue &bucket = bucket_of(addr);
+    WordLock &lock = wait_lock(&bucket);
+    WokenList woken;
+    lock.lock();
+    Thread *thread = parked_after(bucket, nullptr, addr);
+    while (thread != nullptr) {
+        Thread *next = parked_after(bucket, thread, addr);
+        unpark(bucket, thread, woken);
+        thread = next;
+    }
+    if (callback != nullptr) {
+        callback(addr);
+    }
+    lock.unlock();
+    return woken.ready(*scheduler);
+}
@@ -0,0 +1,35 @@
+#ifndef MICROFIBER_PARKING_LOT_H
+#define MICROFIBER_PARKING_LOT_H
+
+// The parking lot keeps the threads waiting on a synchronization primitive out of the primitive itself, in a hash
+// table of wait queues keyed by the primitive's address, like a futex. A primitive then only needs the bits of state it
+// checks on its fast path, and costs nothing more however many of them there are. The table has about one bucket per
+// thread that may wait; threads whose addresses share a bucket are told apart by Thread::park_addr.
+//
+// Each bucket is guarded by the wait lock of its queue. A primitive's validate and callback functions run under it, so
+// that checking the primitive's word and queuing on it are one step for every unpark of the same address, which
+// updates the word under the same lock.
+
+// Size the table for max_threads threads, 0 meaning no limit
+void parking_lot_init(unsigned max_threads);
+
+// Empty the table, dropping the threads still parked
+void parking_lot_end();
+
+// Block the calling thread on addr until another thread unparks it, or it is killed. validate runs first, under the
+// bucket lock: the thread parks only if it returns true, and parking_lot_park returns false at once otherwise.
+// before_block, if not nullptr, is called with arg once the thread is queued and the bucket lock released, before it
+// blocks. Must be called with interrupts disabled.
+bool parking_lot_park(const void *addr, bool (*validate)(const void *addr), void (*before_block)(void *arg),
+                      void *arg);
+
+// Make the thread that parked on addr first ready. Returns whether there was one. callback, if not nullptr, is called
+// under the bucket lock with whether other threads are still parked on addr, before the thread is made ready. Must be
+// called with interrupts disabled.
+bool parking_lot_unpark_one(const void *addr, void (*callback)(const void *addr, bool more_parked));
+
+// Make every thread parked on addr ready, in the order they parked, returns how many. callback, if not nullptr, is
+// called under the bucket lock once they are all taken off it. Must be called with interrupts disabled.
+unsigned parking_lot_unpark_all(const void *addr, void (*callback)(const void *addr));
+
+#endif //MICROFIBER_PARKING_LOT_H
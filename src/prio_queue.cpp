@@ -0,0 +1,81 @@
+#include "prio_queue.hpp"
+#include "thread_manager.hpp"
+
+PrioQueue::PrioQueue() : words(), summary(0), len(0) {}
+
+PrioQueue::~PrioQueue() {
+    assert(summary == 0);
+    assert(len == 0);
+}
+
+int PrioQueue::level_of(int prio) {
+    long level = static_cast<long>(prio) - PRIO_LEVEL_MIN;
+    return level >= 0 && level < PRIO_LEVELS ? static_cast<int>(level) : -1;
+}
+
+FifoQueue &PrioQueue::queue_of(int prio, int level) {
+    if (level >= 0) return levels[level];
+    return prio < PRIO_LEVEL_MIN ? before : after;
+}
+
+void PrioQueue::mark_empty(int level) {
+    int w = level / WORD_BITS;
+    words[w] &= ~(uint64_t{1} << (level % WORD_BITS));
+    if (words[w] == 0) {
+        summary &= ~(uint64_t{1} << w);
+    }
+}
+
+Thread *PrioQueue::pop() {
+    Thread *node;
+    if (before.count() != 0) {
+        node = before.pop();
+    } else if (summary != 0) {
+        int w = __builtin_ctzll(summary);
+        int level = w * WORD_BITS + __builtin_ctzll(words[w]);
+
+        node = levels[level].pop();
+        assert(node != nullptr);
+        if (levels[level].count() == 0) {
+            mark_empty(level);
+        }
+    } else {
+        node = after.pop();
+        if (node == nullptr) return nullptr;
+    }
+    len--;
+    return node;
+}
+
+void PrioQueue::push(Thread *node) {
+    assert(node != nullptr);
+
+    int level = level_of(node->prio);
+    if (level < 0) {
+        queue_of(node->prio, level).push_sorted(node);
+    } else {
+        levels[level].push(node);
+
+        int w = level / WORD_BITS;
+        words[w] |= uint64_t{1} << (level % WORD_BITS);
+        summary |= uint64_t{1} << w;
+    }
+    len++;
+}
+
+Thread *PrioQueue::remove(Thread *node) {
+    assert(node != nullptr);
+
+    int level = level_of(node->prio);
+    if (queue_of(node->prio, level).remove(node) == nullptr) return nullptr;
+
+    if (level >= 0 && levels[level].count() == 0) {
+        mark_empty(level);
+    }
+    len--;
+    return node;
+}
+
+unsigned PrioQueue::count() const {
+    return len;
+}
@@ -0,0 +1,51 @@
+#ifndef MICROFIBER_PRIO_QUEUE_H
+#define MICROFIBER_PRIO_QUEUE_H
+
+#include <cstdint>
+#include "microfiber.hpp"
+#include "queue.hpp"
+
+// A run queue with one FIFO per priority level and a two-level occupancy bitmap. The highest priority (lowest
+// number) non-empty level is found with two find-first-set instructions, so every operation is constant time.
+// Priorities outside the levels are kept in sorted queues before and after them.
+class PrioQueue {
+public:
+    PrioQueue();
+
+    ~PrioQueue();
+
+    // Returns the first node of the highest priority level and removes it from the queue, or NULL if the queue is empty
+    Thread *pop();
+
+    // Insert the node at the end of its priority level
+    void push(Thread *node);
+
+    // Remove the node from the queue, returns the node or NULL if it is not in this queue
+    Thread *remove(Thread *node);
+
+    // Returns the number of items currently in the queue
+    [[nodiscard]] unsigned count() const;
+
+private:
+    static constexpr int WORD_BITS = 64;
+
+    // The level of prio, or -1 if it is outside the levels
+    static int level_of(int prio);
+
+    // The queue holding threads of priority prio
+    FifoQueue &queue_of(int prio, int level);
+
+    void mark_empty(int level);
+
+    FifoQueue before;                         // priorities below PRIO_LEVEL_MIN, sorted
+    FifoQueue levels[PRIO_LEVELS];
+    FifoQueue after;                          // priorities past the last level, sorted
+    uint64_t words[PRIO_LEVELS / WORD_BITS];  // bit i of words[w] is set if level w * 64 + i is non-empty
+    uint64_t summary;                         // bit w is set if words[w] is non-zero
+    unsigned len;
+
+    static_assert(PRIO_LEVELS % WORD_BITS == 0 && PRIO_LEVELS / WORD_BITS <= WORD_BITS,
+                  "priority levels must fit in a two-level bitmap");
+};
+
+#endif //MICROFIBER_PRIO_QUEUE_H
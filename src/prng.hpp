@@ -0,0 +1,52 @@
+#ifndef MICROFIBER_PRNG_H
+#define MICROFIBER_PRNG_H
+
+#include <cstdint>
+
+// xoshiro256** pseudo-random generator, private to the scheduler that owns it so that neither its sequence nor its
+// cost depends on the program's use of rand()
+class Prng {
+public:
+    explicit Prng(uint64_t seed = 0) {
+        this->seed(seed);
+    }
+
+    // Reset the state from a 64-bit seed, expanded with splitmix64 as recommended by the xoshiro authors
+    void seed(uint64_t seed) {
+        for (uint64_t &word: s) {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+    // A value in [0, bound), using a multiply-shift instead of a division
+    uint64_t below(uint64_t bound) {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(next()) * bound) >> 64);
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t s[4];
+};
+
+#endif //MICROFIBER_PRNG_H
@@ -1,6 +1,14 @@
 #include "queue.hpp"
+#include "thread_manager.hpp"
 #include <stdexcept>
 
+FifoQueue::FifoQueue() {
+    this->first = nullptr;
+    this->last = nullptr;
+    this->len = 0;
+    this->capacity = 0;
+}
+
 FifoQueue::FifoQueue(unsigned capacity) {
     if (capacity <= 0) {
         throw std::invalid_argument("Capacity must be > 0");
@@ -19,104 +27,93 @@ FifoQueue::~FifoQueue() {
 
 bool FifoQueue::node_in_queue(const Thread *node) {
     assert(node != nullptr);
-    return node->in_queue;
+    return node->queue != nullptr;
+}
+
+bool FifoQueue::contains(const Thread *node) const {
+    assert(node != nullptr);
+    return node->queue == this;
 }
 
 Thread *FifoQueue::pop() {
     if (first == nullptr) return nullptr;
-
-    Thread *removed = first;
-    first = first->next;
-    if (first == nullptr) last = nullptr;
-
-    len--;
-    removed->in_queue = false;
-    removed->next = nullptr;
-
-    return removed;
+    return remove(first);
 }
 
 Thread *FifoQueue::top() const {
     return first;
 }
 
-int FifoQueue::push(Thread *node) {
-    assert(node != nullptr);
-    assert(node->in_queue == false);
-
-    if (len >= capacity) return -1;
-
-    if (first == nullptr) {
+// Link node into the queue between prev and next, either of which may be NULL at the ends
+void FifoQueue::link(Thread *node, Thread *prev, Thread *next) {
+    node->prev = prev;
+    node->next = next;
+    if (prev == nullptr) {
         first = node;
-        last = node;
     } else {
-        last->next = node;
+        prev->next = node;
+    }
+    if (next == nullptr) {
         last = node;
+    } else {
+        next->prev = node;
     }
-
-    last->in_queue = true;
-    last->next = nullptr;
+    node->queue = this;
     len++;
+}
+
+int FifoQueue::push(Thread *node) {
+    assert(node != nullptr);
+    assert(!node_in_queue(node));
 
+    if (capacity != 0 && len >= capacity) return -1;
+
+    link(node, last, nullptr);
     return 0;
 }
 
 int FifoQueue::push_sorted(Thread *node) {
     assert(node != nullptr);
-    assert(node->in_queue == false);
+    assert(!node_in_queue(node));
 
-    if (len >= capacity) return -1;
+    if (capacity != 0 && len >= capacity) return -1;
 
-    if (first == nullptr) {
-        first = last = node;
-    } else {
-        Thread *prev = nullptr;
-        Thread *curr = first;
-        while (curr != nullptr && curr->prio <= node->prio) {
-            prev = curr;
-            curr = curr->next;
-        }
-
-        if (prev == nullptr) {
-            node->next = first;
-            first = node;
-        } else {
-            prev->next = node;
-            node->next = curr;
-            if (curr == nullptr) {
-                last = node;
-            }
-        }
+    // Walk back from the end, threads of equal priority keep their FIFO order
+    Thread *prev = last;
+    while (prev != nullptr && prev->prio > node->prio) {
+        prev = prev->prev;
     }
 
-    node->in_queue = true;
-    len++;
+    link(node, prev, prev == nullptr ? first : prev->next);
     return 0;
 }
 
-Thread *FifoQueue::remove(int id) {
-    Thread *prev = nullptr;
-    Thread *curr = first;
-
-    while (curr != nullptr) {
-        if (curr->id == id) {
-            if (prev == nullptr) {
-                first = curr->next;
-                if (first == nullptr) last = nullptr;
-            } else {
-                prev->next = curr->next;
-                if (curr->next == nullptr) last = prev;
-            }
-            curr->next = nullptr;
-            curr->in_queue = false;
-            len--;
-            return curr;
-        }
-        prev = curr;
-        curr = curr->next;
+Thread *FifoQueue::remove(Thread *node) {
+    assert(node != nullptr);
+    if (!contains(node)) return nullptr;
+
+    if (node->prev == nullptr) {
+        first = node->next;
+    } else {
+        node->prev->next = node->next;
+    }
+    if (node->next == nullptr) {
+        last = node->prev;
+    } else {
+        node->next->prev = node->prev;
     }
 
-    return nullptr;
+    node->next = nullptr;
+    node->prev = nullptr;
+    node->queue = nullptr;
+    len--;
+    return node;
+}
+
+Thread *FifoQueue::remove(int id) {
+    Thread *node = thread_get(id);
+    if (node == nullptr) return nullptr;
+    return remove(node);
 }
 
 unsigned FifoQueue::count() const {
@@ -3,31 +3,43 @@
 
 #include <cstddef>
 #include <cassert>
-#include "thread_manager.hpp"
 
 class Thread;
 
+// An intrusive doubly linked queue of threads. Each thread records the queue it is in, so a known thread can be removed
+// in constant time.
 class FifoQueue {
 public:
+    // Create an unbounded queue
+    FifoQueue();
+
+    // Create a queue that holds at most capacity nodes
     explicit FifoQueue(unsigned capacity);
 
     ~FifoQueue();
 
-    // Check if the node is already in the queue
+    // Check if the node is already in a queue
     static bool node_in_queue(const Thread *node);
 
+    // Check if the node is in this queue
+    [[nodiscard]] bool contains(const Thread *node) const;
+
     // Returns the node at the top of the queue and removes it from the queue, or NULL if the queue is empty
     Thread *pop();
 
     // Returns the node at the top of the queue without popping it, or NULL if the queue is empty
     [[nodiscard]] Thread *top() const;
 
-    // Insert the node to the end of the queue, returns 0 on success, -1 if the queue is at capacity
+    // Insert the node to the end of the queue, returns 0 on success, -1 if a bounded queue is at capacity
     int push(Thread *node);
 
-    // Insert the node to the queue in sorted order based on priority, returns 0 on success, -1 if the queue is at capacity
+    // Insert the node to the queue in sorted order based on priority, returns 0 on success, -1 if a bounded queue is at
+    // capacity
     int push_sorted(Thread *node);
 
+    // Removes the node from the queue and returns it, or NULL if it is not in this queue
+    Thread *remove(Thread *node);
+
     // Returns the node in the queue with the given id and removes it from the queue, or NULL if not found
     Thread *remove(int id);
 
@@ -35,10 +47,12 @@ public:
     [[nodiscard]] unsigned count() const;
 
 private:
+    void link(Thread *node, Thread *prev, Thread *next);
+
     Thread *first;
     Thread *last;
     unsigned len;
-    unsigned capacity;
+    unsigned capacity;          // 0 if unbounded
 };
 
 #endif // QUEUE_HPP
@@ -0,0 +1,347 @@
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "thread_manager.hpp"
+#include "event_loop.hpp"
+#include "uring.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// Run op until it does not fail with EAGAIN, parking the current thread on fd whenever it does. The system call runs
+// with preemption enabled, so that a regular file, which really blocks, only holds up its own worker. Registration and
+// parking happen with preemption disabled; an edge dispatched between a failed attempt and the parking shows in the
+// fd's edge count, under the lock of the fd's wait queue, and the attempt is repeated.
+template<class Op>
+static ssize_t io_retry(int fd, short events, Op op) {
+    int enabled = InterruptManager::interrupt_off();
+    int registered = event_loop_register(fd);
+    unsigned edges = event_loop_edges(fd);
+    int saved_errno = errno;
+    InterruptManager::interrupt_set(enabled);
+    errno = saved_errno;
+    if (registered < 0) {
+        return -1;
+    }
+
+    while (true) {
+        ssize_t ret = op();
+        if (ret >= 0 || registered == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return ret;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+
+        // The fd may have been forgotten by io_close meanwhile, registering again finds out
+        int revents = 0;
+        enabled = InterruptManager::interrupt_off();
+        registered = event_loop_register(fd);
+        if (registered == 1) {
+            revents = thread_wait_fd_with(*scheduler, fd, events, UINT64_MAX, edges);
+        }
+        edges = event_loop_edges(fd);
+        saved_errno = errno;
+        InterruptManager::interrupt_set(enabled);
+        errno = saved_errno;
+        if (registered < 0) {
+            return -1;
+        }
+        if (revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+}
+
+// Queue the operation prep fills in on the ring and park the current thread until it completes. Returns the result
+// as the system call would, or -2 if the ring has no room left and the caller should use the fallback path. An fd in
+// non-blocking mode may fail with EAGAIN, then the thread waits for readiness and tries again.
+template<class Prep>
+static ssize_t uring_run(int fd, short events, Prep prep) {
+    int enabled = InterruptManager::interrupt_off();
+    int res;
+    while (true) {
+        Thread *curr = current_thread;
+        uring_lock();
+        struct io_uring_sqe *sqe = uring_get_sqe();
+        if (sqe == nullptr) {
+            uring_unlock();
+            InterruptManager::interrupt_set(enabled);
+            return -2;
+        }
+        prep(sqe);
+        // The entry is only queued by a thread that was not killed, which cannot be claimed before the completion
+        Thread::State running = Thread::State::RUNNING;
+        if (!curr->state.compare_exchange_strong(running, Thread::State::IO_BLOCKED)) {
+            uring_unlock();
+            MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+        }
+        uring_queue(sqe, curr);
+        uring_unlock();
+
+        // Submission happens in the event loop, which worker 0 may be waiting in
+        worker_kick_io();
+        thread_block_with(*scheduler);
+        res = current_thread->io_result;
+        if (res != -EAGAIN || MicroFiber::thread_wait_io(fd, events) < 0) {
+            break;
+        }
+    }
+    InterruptManager::interrupt_set(enabled);
+
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+int MicroFiber::thread_wait_io(int fd, short events) {
+    return thread_wait_io_with(*scheduler, fd, events);
+}
+
+// A single write, through the ring if it is in use and has room
+static ssize_t write_some(int fd, const void *buf, size_t count) {
+    if (uring_enabled()) {
+        ssize_t ret = uring_run(fd, POLLOUT, [&](struct io_uring_sqe *sqe) {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(buf);
+            sqe->len = static_cast<uint32_t>(count);
+            sqe->off = static_cast<uint64_t>(-1);   // At the file position, as write does
+        });
+        if (ret != -2) {
+            return ret;
+        }
+    }
+    return io_retry(fd, POLLOUT, [&] { return write(fd, buf, count); });
+}
+
+// Run by the offload pool when io_fsync cannot use the ring
+static int fsync_job(void *arg) {
+    return fsync(static_cast<int>(reinterpret_cast<intptr_t>(arg)));
+}
+
+ssize_t MicroFiber::io_read(int fd, void *buf, size_t count) {
+    if (uring_enabled()) {
+        ssize_t ret = uring_run(fd, POLLIN, [&](struct io_uring_sqe *sqe) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(buf);
+            sqe->len = static_cast<uint32_t>(count);
+            sqe->off = static_cast<uint64_t>(-1);   // At the file position, as read does
+        });
+        if (ret != -2) {
+            return ret;
+        }
+    }
+    return io_retry(fd, POLLIN, [&] { return read(fd, buf, count); });
+}
+
+ssize_t MicroFiber::io_write(int fd, const void *buf, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t ret = write_some(fd, static_cast<const char *>(buf) + done, count - done);
+        if (ret < 0) {
+            return done > 0 ? static_cast<ssize_t>(done) : -1;
+        }
+        done += static_cast<size_t>(ret);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+int MicroFiber::io_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    if (uring_enabled()) {
+        ssize_t ret = uring_run(fd, POLLIN, [&](struct io_uring_sqe *sqe) {
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(addr);
+            sqe->addr2 = reinterpret_cast<uint64_t>(addrlen);
+            sqe->accept_flags = SOCK_NONBLOCK;
+        });
+        if (ret != -2) {
+            return static_cast<int>(ret);
+        }
+    }
+    return static_cast<int>(io_retry(fd, POLLIN, [&] { return accept4(fd, addr, addrlen, SOCK_NONBLOCK); }));
+}
+
+int MicroFiber::io_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    int enabled = InterruptManager::interrupt_off();
+    int registered = event_loop_register(fd);
+    int saved_errno = errno;
+    InterruptManager::interrupt_set(enabled);
+    errno = saved_errno;
+    if (registered < 0) {
+        return -1;
+    }
+    if (connect(fd, addr, addrlen) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS && errno != EINTR) {
+        return -1;
+    }
+
+    // The connection completes in the background, the socket turns writable when it has
+    int revents = thread_wait_io(fd, POLLOUT);
+    if (revents < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int MicroFiber::io_poll(struct pollfd *fds, nfds_t nfds, int timeout_ms) {
+    // The poll-as-sleep idiom. Without a timeout the wait below never ends, unless the thread is killed.
+    if (nfds == 0 && timeout_ms >= 0) {
+        thread_sleep_for(static_cast<uint64_t>(timeout_ms) * 1000);
+        return 0;
+    }
+
+    int ret = poll(fds, nfds, 0);
+    if (ret != 0 || timeout_ms == 0) {
+        return ret;
+    }
+    uint64_t deadline = timeout_ms < 0 ? UINT64_MAX : get_time_us() + static_cast<uint64_t>(timeout_ms) * 1000;
+
+    // The fds are watched through an epoll instance of their own, itself an fd that is readable when any of them is
+    // ready. They are added level-triggered and left as they are, so the caller keeps owning them, and the instance is
+    // the only fd the event loop sees. Negative fds are ignored, like poll does.
+    int group = epoll_create1(EPOLL_CLOEXEC);
+    if (group < 0) {
+        return -1;
+    }
+    for (nfds_t i = 0; i < nfds; i++) {
+        if (fds[i].fd < 0) {
+            continue;
+        }
+        struct epoll_event ev{};
+        ev.events = static_cast<uint32_t>(fds[i].events);
+        if (epoll_ctl(group, EPOLL_CTL_ADD, fds[i].fd, &ev) == 0) {
+            continue;
+        }
+        if (errno == EEXIST) {
+            // The fd is listed more than once, watch the union of its events
+            for (nfds_t j = 0; j < i; j++) {
+                if (fds[j].fd == fds[i].fd) {
+                    ev.events |= static_cast<uint32_t>(fds[j].events);
+                }
+            }
+            if (epoll_ctl(group, EPOLL_CTL_MOD, fds[i].fd, &ev) == 0) {
+                continue;
+            }
+        } else if (errno == EPERM) {
+            // A regular file cannot be watched, but is always ready and was reported by the first poll unless the
+            // caller asked for no events, which then never occur
+            continue;
+        }
+        int saved_errno = errno;
+        close(group);
+        errno = saved_errno;
+        return -1;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    if (event_loop_register(group) < 0) {
+        int saved_errno = errno;
+        InterruptManager::interrupt_set(enabled);
+        close(group);
+        errno = saved_errno;
+        return -1;
+    }
+    while (true) {
+        // Taken before the fds are tried, an edge in between keeps the thread from parking
+        unsigned edges = event_loop_edges(group);
+        ret = poll(fds, nfds, 0);
+        if (ret > 0 || (ret < 0 && errno != EINTR)) {
+            break;
+        }
+        if (ret < 0) {
+            continue;
+        }
+        if (thread_wait_fd_with(*scheduler, group, POLLIN, deadline, edges) == 0) {
+            // Timed out, which poll reports by finding nothing ready
+            ret = poll(fds, nfds, 0);
+            break;
+        }
+    }
+    int saved_errno = errno;
+    event_loop_forget(group);
+    close(group);
+    InterruptManager::interrupt_set(enabled);
+    errno = saved_errno;
+    return ret;
+}
+
+ssize_t MicroFiber::io_pread(int fd, void *buf, size_t count, off_t offset) {
+    if (uring_enabled()) {
+        ssize_t ret = uring_run(fd, POLLIN, [&](struct io_uring_sqe *sqe) {
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(buf);
+            sqe->len = static_cast<uint32_t>(count);
+            sqe->off = static_cast<uint64_t>(offset);
+        });
+        if (ret != -2) {
+            return ret;
+        }
+    }
+    if (offset < 0) {
+        return io_read(fd, buf, count);
+    }
+    return io_retry(fd, POLLIN, [&] { return pread(fd, buf, count, offset); });
+}
+
+ssize_t MicroFiber::io_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    if (uring_enabled()) {
+        ssize_t ret = uring_run(fd, POLLOUT, [&](struct io_uring_sqe *sqe) {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(buf);
+            sqe->len = static_cast<uint32_t>(count);
+            sqe->off = static_cast<uint64_t>(offset);
+        });
+        if (ret != -2) {
+            return ret;
+        }
+    }
+    if (offset < 0) {
+        return io_retry(fd, POLLOUT, [&] { return write(fd, buf, count); });
+    }
+    return io_retry(fd, POLLOUT, [&] { return pwrite(fd, buf, count, offset); });
+}
+
+int MicroFiber::io_fsync(int fd) {
+    if (uring_enabled()) {
+        ssize_t ret = uring_run(fd, POLLOUT, [&](struct io_uring_sqe *sqe) {
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = fd;
+        });
+        if (ret != -2) {
+            return static_cast<int>(ret);
+        }
+    }
+    // fsync really blocks, on the offload pool it holds up no other thread
+    return MicroFiber::offload(fsync_job, reinterpret_cast<void *>(static_cast<intptr_t>(fd)));
+}
+
+int MicroFiber::io_close(int fd) {
+    int enabled = InterruptManager::interrupt_off();
+    event_loop_forget(fd);
+    InterruptManager::interrupt_set(enabled);
+    return close(fd);
+}
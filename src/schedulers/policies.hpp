@@ -0,0 +1,360 @@
+#ifndef MICROFIBER_POLICIES_H
+#define MICROFIBER_POLICIES_H
+
+#include <utility>
+#include <vector>
+#include "src/microfiber.hpp"
+#include "src/queue.hpp"
+#include "src/prio_queue.hpp"
+#include "src/thread_manager.hpp"
+#include "src/prng.hpp"
+#include "src/work_deque.hpp"
+#include "src/worker.hpp"
+
+// Run-queue policies. Their operations are inline and non-virtual, so a runtime that knows its policy at compile time
+// (StaticMicroFiber) can inline them into the scheduling paths. PolicyScheduler wraps them for runtime selection.
+
+// Runs threads in the order they became ready
+class FCFSPolicy final {
+public:
+    static constexpr const char *name = "fcfs";
+
+    static constexpr bool is_realtime() { return false; }
+
+    static constexpr bool weighs_priority() { return false; }
+
+    int init(const Config *config) {
+        (void) config;
+        return 0;
+    }
+
+    int enqueue(Thread *thread) {
+        assert(thread->state == Thread::State::READY || thread->state == Thread::State::KILLED);
+        ready_queue.push(thread);
+        return 0;
+    }
+
+    Thread *dequeue() {
+        return ready_queue.pop();
+    }
+
+    Thread *remove(int tid) {
+        return ready_queue.remove(tid);
+    }
+
+    void destroy() {}
+
+private:
+    FifoQueue ready_queue;
+};
+
+// Runs a ready thread chosen uniformly at random. Each ready thread records its position in the ready vector, so a
+// targeted remove is a constant-time swap with the last element.
+class RandPolicy final {
+public:
+    static constexpr const char *name = "rand";
+
+    static constexpr bool is_realtime() { return false; }
+
+    static constexpr bool weighs_priority() { return false; }
+
+    int init(const Config *config) {
+        ready_queue.clear();
+        prng.seed(config->scheduler_seed);
+        return 0;
+    }
+
+    int enqueue(Thread *thread) {
+        thread->ready_index = static_cast<unsigned>(ready_queue.size());
+        ready_queue.push_back(thread);
+        return 0;
+    }
+
+    Thread *dequeue() {
+        if (ready_queue.empty()) {
+            return nullptr;
+        }
+        return take(static_cast<unsigned>(prng.below(ready_queue.size())));
+    }
+
+    Thread *remove(int tid) {
+        Thread *thread = thread_get(tid);
+        if (thread == nullptr || thread->ready_index >= ready_queue.size() ||
+            ready_queue[thread->ready_index] != thread) {
+            return nullptr;
+        }
+        return take(thread->ready_index);
+    }
+
+    void destroy() {
+        ready_queue.clear();
+        ready_queue.shrink_to_fit();
+    }
+
+private:
+    // Remove the thread at index i by moving the last element into its place
+    Thread *take(unsigned i) {
+        Thread *ret = ready_queue[i];
+        ready_queue[i] = ready_queue.back();
+        ready_queue[i]->ready_index = i;
+        ready_queue.pop_back();
+        return ret;
+    }
+
+    std::vector<Thread *> ready_queue;
+    Prng prng;
+};
+
+// Lottery scheduling: each ready thread holds tickets weighted by its priority (lottery_tickets) and the winner of a
+// uniform draw over all tickets runs next. A Fenwick tree over the ready vector keeps ticket prefix sums, so the draw,
+// enqueue and targeted remove are all O(log n).
+class LotteryPolicy final {
+public:
+    static constexpr const char *name = "lottery";
+
+    static constexpr bool is_realtime() { return false; }
+
+    static constexpr bool weighs_priority() { return true; }
+
+    int init(const Config *config) {
+        ready_queue.clear();
+        tickets.clear();
+        tree.assign(1, 0);
+        prng.seed(config->scheduler_seed);
+        return 0;
+    }
+
+    int enqueue(Thread *thread) {
+        auto i = static_cast<unsigned>(ready_queue.size());
+        unsigned long weight = lottery_tickets(thread->prio);
+
+        thread->ready_index = i;
+        ready_queue.push_back(thread);
+        tickets.push_back(weight);
+
+        // The new tree node at position n covers (n - lowbit(n), n]
+        unsigned n = i + 1;
+        tree.push_back(weight + prefix(n - 1) - prefix(n - (n & -n)));
+        return 0;
+    }
+
+    Thread *dequeue() {
+        if (ready_queue.empty()) {
+            return nullptr;
+        }
+        return take(find(prng.below(prefix(static_cast<unsigned>(ready_queue.size())))));
+    }
+
+    Thread *remove(int tid) {
+        Thread *thread = thread_get(tid);
+        if (thread == nullptr || thread->ready_index >= ready_queue.size() ||
+            ready_queue[thread->ready_index] != thread) {
+            return nullptr;
+        }
+        return take(thread->ready_index);
+    }
+
+    void destroy() {
+        ready_queue.clear();
+        ready_queue.shrink_to_fit();
+        tickets.clear();
+        tickets.shrink_to_fit();
+        tree.assign(1, 0);
+    }
+
+private:
+    // Sum of the tickets of the first n ready threads
+    [[nodiscard]] unsigned long prefix(unsigned n) const {
+        unsigned long sum = 0;
+        for (; n > 0; n &= n - 1) {
+            sum += tree[n];
+        }
+        return sum;
+    }
+
+    void add(unsigned i, long delta) {
+        for (unsigned n = i + 1; n < tree.size(); n += n & -n) {
+            tree[n] += delta;
+        }
+    }
+
+    // Index of the thread holding ticket number r, counting from 0
+    [[nodiscard]] unsigned find(unsigned long r) const {
+        unsigned pos = 0;
+        unsigned step = 1;
+        while (step * 2 < tree.size()) step *= 2;
+        for (; step > 0; step /= 2) {
+            if (pos + step < tree.size() && tree[pos + step] <= r) {
+                pos += step;
+                r -= tree[pos];
+            }
+        }
+        return pos;
+    }
+
+    // Remove the thread at index i by moving the last element into its place
+    Thread *take(unsigned i) {
+        Thread *ret = ready_queue[i];
+        auto last = static_cast<unsigned>(ready_queue.size() - 1);
+
+        add(i, static_cast<long>(tickets[last]) - static_cast<long>(tickets[i]));
+        tickets[i] = tickets[last];
+        ready_queue[i] = ready_queue[last];
+        ready_queue[i]->ready_index = i;
+
+        // The last tree node only covers ranges ending at the last position, so dropping it keeps the rest valid
+        ready_queue.pop_back();
+        tickets.pop_back();
+        tree.pop_back();
+        return ret;
+    }
+
+    std::vector<Thread *> ready_queue;
+    std::vector<unsigned long> tickets;
+    std::vector<unsigned long> tree;    // 1-based Fenwick tree over tickets
+    Prng prng;
+};
+
+// Runs the ready thread with the lowest priority number, FIFO among equal priorities
+class PrioPolicy final {
+public:
+    static constexpr const char *name = "prio";
+
+    static constexpr bool is_realtime() { return true; }
+
+    static constexpr bool weighs_priority() { return false; }
+
+    int init(const Config *config) {
+        (void) config;
+        return 0;
+    }
+
+    int enqueue(Thread *thread) {
+        assert(thread->state == Thread::State::READY || thread->state == Thread::State::KILLED);
+        ready_queue.push(thread);
+        return 0;
+    }
+
+    Thread *dequeue() {
+        return ready_queue.pop();
+    }
+
+    Thread *remove(int tid) {
+        Thread *thread = thread_get(tid);
+        if (thread == nullptr) {
+            return nullptr;
+        }
+        return ready_queue.remove(thread);
+    }
+
+    void destroy() {}
+
+private:
+    PrioQueue ready_queue;
+};
+
+// Work stealing for several workers. Threads that have not run yet go to a Chase-Lev deque: the worker that created
+// them runs the newest first, depth first like the recursive calls they replace, and a worker out of threads steals the
+// oldest from another worker's deque, which in a fork-join computation is the biggest piece of work left. The owner
+// pushes and pops without any lock, as only its own worker touches the policy and the deque is lock-free; a thief
+// steals from its idle fiber, so that the workers out of threads do not hold up those that have some. Threads that
+// have run stay on their worker, as their frames may hold the address of the worker's thread-local variables, errno
+// included, cached by the compiler.
+//
+// Threads that have run come first, so that a joining parent reaps its children and exits before more of the tree is
+// started; otherwise every thread of the tree would be alive at once. The thread woken last runs next, the others wait
+// in FIFO order, and each new thread started lets every thread already waiting run before the next one is, so that
+// neither side can starve the other.
+class WorkStealingPolicy final {
+public:
+    static constexpr const char *name = "steal";
+
+    static constexpr bool is_realtime() { return false; }
+
+    static constexpr bool weighs_priority() { return false; }
+
+    int init(const Config *config) {
+        (void) config;
+        next = nullptr;
+        return 0;
+    }
+
+    int enqueue(Thread *thread) {
+        assert(thread->state == Thread::State::READY || thread->state == Thread::State::KILLED);
+        if (!thread->started) {
+            fresh.push(thread);
+            return 0;
+        }
+        if (thread != current_thread) {
+            std::swap(thread, next);
+            if (thread == nullptr) {
+                return 0;
+            }
+        }
+        thread->ready_index = stamp++;
+        resumed.push(thread);
+        return 0;
+    }
+
+    Thread *dequeue() {
+        Thread *thread = next;
+        if (thread != nullptr) {
+            next = nullptr;
+            return thread;
+        }
+        thread = resumed.top();
+        if (thread != nullptr && static_cast<int>(thread->ready_index - round) < 0) {
+            return resumed.pop();
+        }
+        thread = fresh.pop();
+        if (thread != nullptr) {
+            round = stamp;
+            return thread;
+        }
+        // A worker out of threads steals from its idle fiber, see worker_steal
+        return resumed.pop();
+    }
+
+    Thread *remove(int tid) {
+        Thread *thread = thread_get(tid);
+        if (thread == nullptr) {
+            return nullptr;
+        }
+        if (thread == next) {
+            next = nullptr;
+            return thread;
+        }
+        if (resumed.contains(thread)) {
+            return resumed.remove(thread);
+        }
+        // A thread of another worker sits in that worker's deque, which only its owner takes from the middle
+        if (thread->started || thread->worker != this_worker) {
+            return nullptr;
+        }
+        return fresh.remove(thread);
+    }
+
+    // Take the oldest thread that has not run yet, for another worker. Safe against the owner's push and pop.
+    Thread *steal() {
+        return fresh.steal();
+    }
+
+    // Whether threads that have not run yet wait in the deque; exact on the owner, a snapshot on other workers
+    [[nodiscard]] bool stealable() const {
+        return fresh.count() != 0;
+    }
+
+    void destroy() {
+        next = nullptr;
+        fresh.clear();
+    }
+
+private:
+    Thread *next = nullptr;     // the thread woken last
+    unsigned stamp = 0;         // enqueue order of the resumed threads, kept in their ready_index
+    unsigned round = 0;         // stamp when the last new thread was started, older resumed threads run first
+    WorkDeque fresh;
+    FifoQueue resumed;
+};
+
+#endif //MICROFIBER_POLICIES_H
@@ -1,33 +1,69 @@
 #include "scheduler.hpp"
 
-// Global pointer to the current scheduler
-Scheduler *scheduler;
+// Pointer to the scheduler of the calling worker
+thread_local Scheduler *scheduler;
 
 // Set of available schedulers
 std::vector<Scheduler *> schedulers = {
         new RandScheduler(),
         new FCFScheduler(),
-        new PrioScheduler()
+        new PrioScheduler(),
+        new LotteryScheduler(),
+        new WorkStealingScheduler()
 };
 
 /* Initialize the scheduling subsystem */
-bool scheduler_init(Scheduler::Type type) {
+bool scheduler_init(const Config *config) {
+    Scheduler::Type type = config->scheduler_name;
     scheduler = nullptr;
 
     auto it = std::find_if(schedulers.begin(), schedulers.end(),
                            [type](Scheduler *&s) {
                                return s->get_name() == (type == Scheduler::Type::Random ? "rand" :
-                                                        type == Scheduler::Type::FCFS ? "fcfs" : "prio");
+                                                        type == Scheduler::Type::FCFS ? "fcfs" :
+                                                        type == Scheduler::Type::Lottery ? "lottery" :
+                                                        type == Scheduler::Type::WorkStealing ? "steal" : "prio");
                            });
 
     if (it != schedulers.end()) {
         scheduler = *it;
-        return scheduler->init() == 0;
+        return scheduler->init(config) == 0;
     }
 
     return false;
 }
 
+bool scheduler_init(Scheduler *instance, const Config *config) {
+    scheduler = instance;
+    return scheduler->init(config) == 0;
+}
+
+Scheduler *scheduler_create(const Config *config) {
+    Scheduler *instance;
+    switch (config->scheduler_name) {
+        case Scheduler::Type::Random:
+            instance = new RandScheduler();
+            break;
+        case Scheduler::Type::FCFS:
+            instance = new FCFScheduler();
+            break;
+        case Scheduler::Type::Lottery:
+            instance = new LotteryScheduler();
+            break;
+        case Scheduler::Type::WorkStealing:
+            instance = new WorkStealingScheduler();
+            break;
+        default:
+            instance = new PrioScheduler();
+            break;
+    }
+    if (instance->init(config) != 0) {
+        delete instance;
+        return nullptr;
+    }
+    return instance;
+}
+
 void scheduler_end() {
     if (scheduler != nullptr) {
         scheduler->destroy();
@@ -3,6 +3,8 @@
 
 #include "src/microfiber.hpp"
 #include "src/queue.hpp"
+#include "src/thread_manager.hpp"
+#include "policies.hpp"
 
 class Scheduler {
 public:
@@ -10,7 +12,7 @@ public:
 
     virtual ~Scheduler() = default;
 
-    virtual int init() = 0;
+    virtual int init(const Config *config) = 0;
 
     virtual int enqueue(Thread *thread) = 0;
 
@@ -24,69 +26,77 @@ public:
         return realtime;
     }
 
+    [[nodiscard]] bool weighs_priority() const {
+        return weighs_prio;
+    }
+
     [[nodiscard]] const std::string &get_name() const {
         return name;
     }
 
 protected:
-    Scheduler(std::string name, bool realtime)
-            : name(std::move(name)), realtime(realtime) {}
+    Scheduler(std::string name, bool realtime, bool weighs_prio)
+            : name(std::move(name)), realtime(realtime), weighs_prio(weighs_prio) {}
 
 private:
     std::string name;
     bool realtime;
+    bool weighs_prio;           // whether the scheduler picks by priority itself, so yield must not override it
 };
 
 
-class RandScheduler : public Scheduler {
+// Adapts a compile-time policy to the polymorphic Scheduler interface
+template<class Policy>
+class PolicyScheduler final : public Scheduler {
 public:
-    RandScheduler() : Scheduler("rand", false) {}
-
-    int init() override;
-
-    int enqueue(Thread *thread) override;
-
-    Thread *dequeue() override;
+    PolicyScheduler() : Scheduler(Policy::name, Policy::is_realtime(), Policy::weighs_priority()) {}
 
-    Thread *remove(int tid) override;
-
-    void destroy() override;
-};
+    int init(const Config *config) override {
+        return policy.init(config);
+    }
 
-class FCFScheduler : public Scheduler {
-public:
-    FCFScheduler() : Scheduler("fcfs", false) {}
+    int enqueue(Thread *thread) override {
+        return policy.enqueue(thread);
+    }
 
-    int init() override;
+    Thread *dequeue() override {
+        return policy.dequeue();
+    }
 
-    int enqueue(Thread *thread) override;
+    Thread *remove(int tid) override {
+        return policy.remove(tid);
+    }
 
-    Thread *dequeue() override;
+    void destroy() override {
+        policy.destroy();
+    }
 
-    Thread *remove(int tid) override;
+    Policy &get_policy() {
+        return policy;
+    }
 
-    void destroy() override;
+private:
+    Policy policy;
 };
 
-class PrioScheduler : public Scheduler {
-public:
-    PrioScheduler() : Scheduler("prio", true) {}
-
-    int init() override;
-
-    int enqueue(Thread *thread) override;
+using RandScheduler = PolicyScheduler<RandPolicy>;
+using FCFScheduler = PolicyScheduler<FCFSPolicy>;
+using PrioScheduler = PolicyScheduler<PrioPolicy>;
+using LotteryScheduler = PolicyScheduler<LotteryPolicy>;
+using WorkStealingScheduler = PolicyScheduler<WorkStealingPolicy>;
 
-    Thread *dequeue() override;
 
-    Thread *remove(int tid) override;
-
-    void destroy() override;
-};
+// The run queue of the calling worker
+extern thread_local Scheduler *scheduler;
 
+bool scheduler_init(const Config *config);
 
-extern Scheduler *scheduler;
+// A new, initialized scheduler of the type selected by config->scheduler_name, for another worker's run queue, or
+// nullptr if its initialization fails
+Scheduler *scheduler_create(const Config *config);
 
-bool scheduler_init(Scheduler::Type type);
+// Install the given scheduler instead of the one selected by config->scheduler_name
+bool scheduler_init(Scheduler *instance, const Config *config);
 
 void scheduler_end();
 
@@ -0,0 +1,196 @@
+#include "stack_pool.hpp"
+#include "microfiber.hpp"
+#include "topology.hpp"
+#include "word_lock.hpp"
+#include <atomic>
+#include <cassert>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// An idle stack, linked through its topmost bytes. That end of the stack is always touched by a running fiber, so
+// keeping the link there does not commit pages that the fiber itself never used.
+struct FreeStack {
+    FreeStack *next;
+};
+
+// Stacks a worker keeps to itself at most
+constexpr unsigned STACK_CACHE_SIZE = 16;
+
+// Free lists of idle stacks, one per NUMA node and stack size, guarded by pool_lock. A stack stays on the node it was
+// first placed on, so it only ever goes back to that node's lists.
+static std::vector<std::unordered_map<size_t, FreeStack *>> free_lists;
+static WordLock pool_lock;
+
+// The stacks the calling worker freed last, all of cache_size bytes on cache_node
+static thread_local FreeStack *cache = nullptr;
+static thread_local unsigned cache_count = 0;
+static thread_local size_t cache_size = 0;
+static thread_local int cache_node = 0;
+
+static size_t high_water = 0;
+static size_t page_size = 0;
+
+// The counters of StackPoolStats, idle stacks in the workers' caches included
+static std::atomic<unsigned long> hits(0);
+static std::atomic<unsigned long> misses(0);
+static std::atomic<unsigned long> trims(0);
+static std::atomic<unsigned long> idle_stacks(0);
+static std::atomic<size_t> idle_bytes(0);
+
+static FreeStack *stack_to_node(void *stack, size_t size) {
+    return reinterpret_cast<FreeStack *>(static_cast<char *>(stack) + size) - 1;
+}
+
+static void *node_to_stack(FreeStack *node, size_t size) {
+    return reinterpret_cast<char *>(node + 1) - size;
+}
+
+// Map a stack with a guard page below it. Pages are committed lazily by the kernel as the fiber touches them, on
+// numa_node.
+static void *stack_map(size_t size, int numa_node) {
+    void *base = mmap(nullptr, size + page_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (mprotect(base, page_size, PROT_NONE) != 0) {
+        munmap(base, size + page_size);
+        return nullptr;
+    }
+    void *stack = static_cast<char *>(base) + page_size;
+    topology_bind(stack, size, numa_node);
+    return stack;
+}
+
+static void stack_unmap(void *stack, size_t size) {
+    int ret = munmap(static_cast<char *>(stack) - page_size, size + page_size);
+    assert(!ret);
+}
+
+void stack_pool_init(size_t limit) {
+    assert(free_lists.empty());
+    high_water = limit;
+    page_size = sysconf(_SC_PAGESIZE);
+    hits.store(0);
+    misses.store(0);
+    trims.store(0);
+    idle_stacks.store(0);
+    idle_bytes.store(0);
+}
+
+size_t stack_pool_round(size_t size) {
+    assert(page_size != 0);
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+// The free lists of numa_node, created on first use, with pool_lock held
+static std::unordered_map<size_t, FreeStack *> &node_lists(int numa_node) {
+    auto index = static_cast<size_t>(numa_node > 0 ? numa_node : 0);
+    if (index >= free_lists.size()) {
+        free_lists.resize(index + 1);
+    }
+    return free_lists[index];
+}
+
+void *stack_pool_alloc(size_t size, int numa_node) {
+    assert(size == stack_pool_round(size));
+
+    FreeStack *node = nullptr;
+    if (cache_count != 0 && cache_size == size && cache_node == numa_node) {
+        node = cache;
+        cache = node->next;
+        cache_count--;
+    } else {
+        pool_lock.lock();
+        auto &lists = node_lists(numa_node);
+        auto it = lists.find(size);
+        if (it != lists.end() && it->second != nullptr) {
+            node = it->second;
+            it->second = node->next;
+        }
+        pool_lock.unlock();
+    }
+    if (node != nullptr) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        idle_stacks.fetch_sub(1, std::memory_order_relaxed);
+        idle_bytes.fetch_sub(size, std::memory_order_relaxed);
+        return node_to_stack(node, size);
+    }
+
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return stack_map(size, numa_node);
+}
+
+void stack_pool_free(void *stack, size_t size, int numa_node) {
+    if (stack == nullptr) return;
+
+    // Above the high-water mark the stack goes straight back to the system
+    if (idle_bytes.fetch_add(size, std::memory_order_relaxed) + size > high_water) {
+        idle_bytes.fetch_sub(size, std::memory_order_relaxed);
+        trims.fetch_add(1, std::memory_order_relaxed);
+        stack_unmap(stack, size);
+        return;
+    }
+    idle_stacks.fetch_add(1, std::memory_order_relaxed);
+
+    FreeStack *node = stack_to_node(stack, size);
+    if (cache_count == 0 || (cache_count < STACK_CACHE_SIZE && cache_size == size && cache_node == numa_node)) {
+        node->next = cache;
+        cache = node;
+        cache_count++;
+        cache_size = size;
+        cache_node = numa_node;
+        return;
+    }
+    pool_lock.lock();
+    FreeStack *&head = node_lists(numa_node)[size];
+    node->next = head;
+    head = node;
+    pool_lock.unlock();
+}
+
+void stack_pool_flush() {
+    if (cache_count == 0) {
+        return;
+    }
+    pool_lock.lock();
+    FreeStack *&head = node_lists(cache_node)[cache_size];
+    while (cache != nullptr) {
+        FreeStack *node = cache;
+        cache = node->next;
+        node->next = head;
+        head = node;
+    }
+    pool_lock.unlock();
+    cache_count = 0;
+}
+
+void stack_pool_end() {
+    stack_pool_flush();
+    for (auto &lists: free_lists) {
+        for (auto &entry: lists) {
+            FreeStack *node = entry.second;
+            while (node != nullptr) {
+                FreeStack *next = node->next;
+                stack_unmap(node_to_stack(node, entry.first), entry.first);
+                node = next;
+            }
+        }
+    }
+    free_lists.clear();
+    idle_stacks.store(0);
+    idle_bytes.store(0);
+}
+
+StackPoolStats MicroFiber::get_stack_pool_stats() {
+    StackPoolStats ret{};
+    ret.hits = hits.load(std::memory_order_relaxed);
+    ret.misses = misses.load(std::memory_order_relaxed);
+    ret.trims = trims.load(std::memory_order_relaxed);
+    ret.idle_stacks = idle_stacks.load(std::memory_order_relaxed);
+    ret.idle_bytes = idle_bytes.load(std::memory_order_relaxed);
+    return ret;
+}
@@ -0,0 +1,29 @@
+#ifndef MICROFIBER_STACK_POOL_H
+#define MICROFIBER_STACK_POOL_H
+
+#include <cstddef>
+
+// Idle stacks are kept in free lists per NUMA node and size, guarded by a lock of the pool. Each worker also keeps the
+// last few stacks of one size and node it freed to itself, which the threads it creates next reuse without the lock.
+
+// Initialize the stack pool, keeping at most high_water bytes of idle stacks for reuse
+void stack_pool_init(size_t high_water);
+
+// Round a requested stack size up to the size that stack_pool_alloc will actually provide
+size_t stack_pool_round(size_t size);
+
+// Get a stack of the given size (as returned by stack_pool_round) placed on NUMA node numa_node, reusing an idle one of
+// the same size and node if available. The stack is mapped with an inaccessible guard page below it, so an overflow
+// faults instead of corrupting memory. Returns nullptr if out of memory.
+void *stack_pool_alloc(size_t size, int numa_node);
+
+// Return a stack allocated for numa_node to the pool, or to the system if the pool is above its high-water mark
+void stack_pool_free(void *stack, size_t size, int numa_node);
+
+// Hand the stacks the calling worker keeps to itself back to the free lists, before its system thread ends
+void stack_pool_flush();
+
+// Release every idle stack back to the system
+void stack_pool_end();
+
+#endif //MICROFIBER_STACK_POOL_H
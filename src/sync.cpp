@@ -0,0 +1,205 @@
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "parking_lot.hpp"
+#include "thread_manager.hpp"
+#include "schedulers/scheduler.hpp"
+
+#include <cassert>
+
+// The fast paths take no lock, so the words are updated atomically. A slow path checks the word once more under the
+// lock of its parking lot bucket before it parks, and an unpark updates the word under the same lock, which makes
+// checking a word and parking on it one step for every slow path that wakes a thread.
+
+static_assert(sizeof(Lock) == 4, "a Lock must stay a single word");
+static_assert(sizeof(Condition) == 1, "a Condition must stay a single byte");
+
+// A realtime scheduler runs a woken thread of higher priority right away
+static void yield_to_woken(bool woken) {
+    if (woken && scheduler->is_realtime()) {
+        MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    }
+}
+
+////////////////////////
+/*  LOCK OPERATIONS  */
+////////////////////////
+
+Lock::~Lock() {
+    assert((word.load(std::memory_order_relaxed) & ~PARKED) == 0);
+}
+
+uint32_t Lock::owned_word() {
+    assert(current_thread->id >= 0);
+    return static_cast<uint32_t>(current_thread->id + 1) << 1;
+}
+
+void Lock::acquire() {
+    uint32_t expected = 0;
+    if (!word.compare_exchange_strong(expected, owned_word(), std::memory_order_acquire, std::memory_order_relaxed)) {
+        acquire_slow();
+    }
+}
+
+bool Lock::try_acquire() {
+    uint32_t v = word.load(std::memory_order_relaxed);
+    while ((v & ~PARKED) == 0) {
+        if (word.compare_exchange_weak(v, v | owned_word(), std::memory_order_acquire, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Lock::acquire_slow() {
+    int enabled = InterruptManager::interrupt_off();
+
+    uint32_t owned = owned_word();
+    while (true) {
+        uint32_t v = word.load();
+        if ((v & ~PARKED) == 0) {
+            // Keeps PARKED, a woken thread does not know whether others still wait
+            if (word.compare_exchange_weak(v, v | owned)) {
+                break;
+            }
+            continue;
+        }
+        if (!(v & PARKED) && !word.compare_exchange_weak(v, v | PARKED)) {
+            continue;
+        }
+        // Parks only if the lock is still held and its releaser will look at the bucket
+        parking_lot_park(this, [](const void *addr) {
+            uint32_t w = static_cast<const Lock *>(addr)->word.load();
+            return (w & ~PARKED) != 0 && (w & PARKED) != 0;
+        }, nullptr, nullptr);
+    }
+
+    InterruptManager::interrupt_set(enabled);
+}
+
+void Lock::release() {
+    uint32_t expected = owned_word();
+    if (word.compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed)) {
+        return;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    yield_to_woken(release_locked());
+    InterruptManager::interrupt_set(enabled);
+}
+
+bool Lock::release_locked() {
+    uint32_t expected = owned_word();
+    if (word.compare_exchange_strong(expected, 0, std::memory_order_release, std::memory_order_relaxed)) {
+        return false;
+    }
+    // Only PARKED may differ, a lock is released by its owner alone
+    assert((expected & ~PARKED) == owned_word());
+
+    // The woken thread competes for the lock with any thread that comes along before it runs
+    return parking_lot_unpark_one(this, [](const void *addr, bool more_parked) {
+        const_cast<Lock *>(static_cast<const Lock *>(addr))->word.store(more_parked ? PARKED : 0,
+                                                                         std::memory_order_release);
+    });
+}
+
+////////////////////////
+/* CONDITION VARIABLES */
+////////////////////////
+
+void Condition::wait(Lock &lock) {
+    int enabled = InterruptManager::interrupt_off();
+
+    // A notify from now on takes the slow path, which finds this thread parked as the flag is set under the bucket
+    // lock. The lock is released only then.
+    parking_lot_park(this, [](const void *addr) {
+        const_cast<Condition *>(static_cast<const Condition *>(addr))->waiters.store(true);
+        return true;
+    }, [](void *arg) {
+        static_cast<Lock *>(arg)->release_locked();
+    }, &lock);
+
+    InterruptManager::interrupt_set(enabled);
+    lock.acquire();
+}
+
+void Condition::notify_one() {
+    if (!waiters.load()) {
+        return;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    bool woken = parking_lot_unpark_one(this, [](const void *addr, bool more_parked) {
+        const_cast<Condition *>(static_cast<const Condition *>(addr))->waiters.store(more_parked);
+    });
+    yield_to_woken(woken);
+    InterruptManager::interrupt_set(enabled);
+}
+
+void Condition::notify_all() {
+    if (!waiters.load()) {
+        return;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    unsigned woken = parking_lot_unpark_all(this, [](const void *addr) {
+        const_cast<Condition *>(static_cast<const Condition *>(addr))->waiters.store(false);
+    });
+    yield_to_woken(woken > 0);
+    InterruptManager::interrupt_set(enabled);
+}
+
+////////////////////////
+/*     SEMAPHORES     */
+////////////////////////
+
+bool Semaphore::try_acquire() {
+    unsigned v = word.load(std::memory_order_relaxed);
+    while (v > PARKED) {
+        if (word.compare_exchange_weak(v, v - 2, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Semaphore::acquire() {
+    if (try_acquire()) {
+        return;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+
+    while (true) {
+        unsigned v = word.load();
+        if (v > PARKED) {
+            if (word.compare_exchange_weak(v, v - 2)) {
+                break;
+            }
+            continue;
+        }
+        if (!(v & PARKED) && !word.compare_exchange_weak(v, v | PARKED)) {
+            continue;
+        }
+        // Parks only if no unit is left and the next release will look at the bucket
+        parking_lot_park(this, [](const void *addr) {
+            return static_cast<const Semaphore *>(addr)->word.load() == PARKED;
+        }, nullptr, nullptr);
+    }
+
+    InterruptManager::interrupt_set(enabled);
+}
+
+void Semaphore::release() {
+    if (!(word.fetch_add(2, std::memory_order_release) & PARKED)) {
+        return;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    bool woken = parking_lot_unpark_one(this, [](const void *addr, bool more_parked) {
+        if (!more_parked) {
+            const_cast<Semaphore *>(static_cast<const Semaphore *>(addr))->word.fetch_and(~PARKED);
+        }
+    });
+    yield_to_woken(woken);
+    InterruptManager::interrupt_set(enabled);
+}
@@ -1,32 +1,201 @@
-#include <ucontext.h>
 #include "thread_manager.hpp"
 #include "microfiber.hpp"
 #include "interrupt_manager.hpp"
 #include "queue.hpp"
+#include "stack_pool.hpp"
 #include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+#include "timer_wheel.hpp"
+#include "event_loop.hpp"
+#include "uring.hpp"
+#include "wake.hpp"
+#include "worker.hpp"
+#include "topology.hpp"
+
+#include <climits>
+#include <new>
+#include <sys/mman.h>
+#include <vector>
+
+// Number of thread slots added to the table at a time
+constexpr unsigned THREAD_CHUNK_SHIFT = 10;
+constexpr unsigned THREAD_CHUNK_SIZE = 1u << THREAD_CHUNK_SHIFT;
+
+// Bytes mapped for a chunk of the thread table
+constexpr size_t THREAD_CHUNK_BYTES = THREAD_CHUNK_SIZE * sizeof(Thread);
+
+// Chunks needed to give every ThreadID a slot
+constexpr size_t THREAD_CHUNKS_MAX = (static_cast<size_t>(INT_MAX) + 1) >> THREAD_CHUNK_SHIFT;
+
+// Slots freed on a worker that it keeps for the threads it creates next, before they go to the shared free lists
+constexpr unsigned SLOT_CACHE_SIZE = 64;
+
+// Number of wait locks, a power of two
+constexpr unsigned WAIT_LOCKS_SHIFT = 8;
+
+// The thread table grows in chunks that are never moved, so Thread pointers stay valid as it grows. Chunks are mapped
+// directly, so that their pages can be placed on a NUMA node before they are first touched. The directory has a slot
+// for every chunk there can be, mapped without reserving memory so only the pages in use are ever touched, and a chunk
+// is published once its slots are set up, so thread_get takes no lock.
+static std::atomic<Thread *> *thread_chunks = nullptr;
+static std::atomic<size_t> thread_chunk_count(0);
+static unsigned max_thread_count = UINT_MAX;
+
+// Size of a fallback stack, enough to exit from
+constexpr size_t FALLBACK_STACK_SIZE = 16384;
+
+thread_local Thread *current_thread = nullptr;
+
+// A thread that only exits when it first runs, as it was killed or its stack cannot be mapped, does so on the fallback
+// stack of its worker. Every thread that exits finishes on the exit stack of its worker, off its own stack, which a
+// reaper on another worker may reuse as soon as the thread is marked EXITED.
+alignas(16) static thread_local char fallback_stack[FALLBACK_STACK_SIZE];
+alignas(16) static thread_local char exit_stack[FALLBACK_STACK_SIZE];
+static std::atomic<unsigned> thread_count(0);
+std::atomic<int> last_exit_code(0);
+
+// Uninitialized thread slots linked through next, one list per NUMA node, so thread_create finds a free id on the node
+// of the worker the thread is placed on in constant time. Guarded by table_lock, which also serializes growth.
+static std::vector<Thread *> free_threads;
+static WordLock table_lock;
+
+// Slots freed on the calling worker, all on its node, linked through next
+static thread_local Thread *slot_cache = nullptr;
+static thread_local unsigned slot_cache_count = 0;
+
+// The locks of the wait queues, each on a cache line of its own
+struct alignas(CACHE_LINE_SIZE) WaitLock {
+    WordLock lock;
+};
+static WaitLock wait_locks[1u << WAIT_LOCKS_SHIFT];
+
+WordLock &wait_lock(const FifoQueue *queue) {
+    // Fibonacci hashing, the top bits of the product mix in every bit of the address
+    auto key = reinterpret_cast<uintptr_t>(queue);
+    uint64_t hash = static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+    return wait_locks[hash >> (64 - WAIT_LOCKS_SHIFT)].lock;
+}
+
+// Make the slot of t available to thread_create. Called with table_lock held.
+static void free_thread_push(Thread *t) {
+    t->next = free_threads[t->node];
+    free_threads[t->node] = t;
+}
+
+static void thread_chunk_unmap(Thread *chunk) {
+    for (unsigned i = 0; i < THREAD_CHUNK_SIZE; i++) {
+        chunk[i].~Thread();
+    }
+    munmap(chunk, THREAD_CHUNK_BYTES);
+}
+
+// Add a chunk of slots placed on node to the thread table, returns false if out of memory or ThreadIDs. Called with
+// table_lock held.
+static bool thread_table_grow(int node) {
+    size_t count = thread_chunk_count.load(std::memory_order_relaxed);
+    if (count >= THREAD_CHUNKS_MAX) {
+        return false;
+    }
+    void *mem = mmap(nullptr, THREAD_CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    topology_bind(mem, THREAD_CHUNK_BYTES, node);
+    auto *chunk = static_cast<Thread *>(mem);
+    for (unsigned i = 0; i < THREAD_CHUNK_SIZE; i++) {
+        new(&chunk[i]) Thread();
+    }
+
+    // Push in reverse so that ids are handed out in increasing order
+    auto base = static_cast<ThreadID>(count << THREAD_CHUNK_SHIFT);
+    for (int i = THREAD_CHUNK_SIZE - 1; i >= 0; i--) {
+        chunk[i].id = base + i;
+        chunk[i].node = node;
+        free_thread_push(&chunk[i]);
+    }
+    thread_chunks[count].store(chunk, std::memory_order_relaxed);
+    thread_chunk_count.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+// Take a free slot on node, growing the table if needed, or nullptr if out of memory
+static Thread *free_thread_pop(int node) {
+    if (multi_worker() && slot_cache != nullptr && node == this_worker->node) {
+        Thread *t = slot_cache;
+        slot_cache = t->next;
+        slot_cache_count--;
+        t->next = nullptr;
+        return t;
+    }
+
+    table_lock.lock();
+    if (static_cast<size_t>(node) >= free_threads.size()) {
+        free_threads.resize(node + 1, nullptr);
+    }
+    if (free_threads[node] == nullptr && !thread_table_grow(node)) {
+        table_lock.unlock();
+        return nullptr;
+    }
+
+    Thread *t = free_threads[node];
+    free_threads[node] = t->next;
+    table_lock.unlock();
+    t->next = nullptr;
+    return t;
+}
 
-std::vector<Thread> thread_array(MAX_THREAD_COUNT);
-Thread *current_thread = nullptr;
-unsigned thread_count = 0;
+// Give the slot of a destroyed thread back, to the calling worker's cache if it is on its node
+static void free_thread_give(Thread *t) {
+    if (multi_worker() && t->node == this_worker->node && slot_cache_count < SLOT_CACHE_SIZE) {
+        t->next = slot_cache;
+        slot_cache = t;
+        slot_cache_count++;
+        return;
+    }
+    table_lock.lock();
+    free_thread_push(t);
+    table_lock.unlock();
+}
 
 ////////////////////////
 /* THREAD OPERATIONS */
 ////////////////////////
 
-void thread_init() {
+void thread_init(unsigned max_threads) {
     int enabled = InterruptManager::interrupt_off();
 
-    Thread *t = &thread_array[0];
-    t->id = 0;
+    max_thread_count = max_threads != 0 ? max_threads : UINT_MAX;
+    free_threads.clear();
+    assert(thread_chunks == nullptr);
+    void *dir = mmap(nullptr, THREAD_CHUNKS_MAX * sizeof(std::atomic<Thread *>), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (dir == MAP_FAILED) {
+        perror("Mapping the thread table");
+        assert(0);
+    }
+    thread_chunks = static_cast<std::atomic<Thread *> *>(dir);
+    thread_chunk_count.store(0, std::memory_order_relaxed);
+
+    Thread *t = free_thread_pop(this_worker->node);
+    assert(t != nullptr && t->id == 0);
+    t->stack = nullptr;
+    t->stack_size = 0;
     t->next = nullptr;
-    t->in_queue = false;
+    t->prev = nullptr;
+    t->queue = nullptr;
+    t->timer_next = nullptr;
+    t->timer_pprev = nullptr;
+    t->io_fd = -1;
+    t->uring_pending = false;
+    t->offload_pending = false;
+    t->wake_wait = nullptr;
+    t->park_addr = nullptr;
     t->initialized = true;
-    t->setcontext_called = false;
-    t->wait_queue = new FifoQueue(MAX_THREAD_COUNT);
+    t->started = true;
     t->num_reapers = 0;
-    t->member_of = nullptr;
     t->state = Thread::State::RUNNING;
     t->prio = 0;
+    t->worker = this_worker;
 
     current_thread = t;
     thread_count = 1;
@@ -38,220 +207,290 @@ ThreadID MicroFiber::get_thread_id() {
     return current_thread->id;
 }
 
-// Get the thread structure by ID
-static Thread *thread_get(ThreadID tid) {
-    if (tid < 0 || tid >= MAX_THREAD_COUNT || !thread_array[tid].initialized) {
+Thread *thread_get(ThreadID tid) {
+    if (tid < 0) {
+        return nullptr;
+    }
+    auto chunk = static_cast<size_t>(tid) >> THREAD_CHUNK_SHIFT;
+    if (chunk >= thread_chunk_count.load(std::memory_order_acquire)) {
         return nullptr;
     }
-    return &thread_array[tid];
+
+    Thread *t = &thread_chunks[chunk].load(std::memory_order_relaxed)[tid & (THREAD_CHUNK_SIZE - 1)];
+    return t->initialized ? t : nullptr;
 }
 
-// Check if the thread is runnable
-static bool thread_runnable(ThreadID tid) {
+bool thread_runnable(ThreadID tid) {
     int enabled = InterruptManager::interrupt_off();
     struct Thread *t = thread_get(tid);
     InterruptManager::interrupt_set(enabled);
-    return (t != nullptr && (t->state == Thread::State::READY ||
-                             t->state == Thread::State::RUNNING ||
-                             t->state == Thread::State::KILLED));
+    if (t == nullptr) {
+        return false;
+    }
+    Thread::State state = t->state;
+    return state == Thread::State::READY || state == Thread::State::RUNNING || state == Thread::State::KILLED;
 }
 
 // New thread starts executing here
-static void thread_stub(int (*thread_main)(void *), void *arg) {
+static void thread_stub(void *fn, void *arg) {
+    current_thread->started = true;
+
     InterruptManager::interrupt_set(1);
+    auto thread_main = reinterpret_cast<MicroFiber::ThreadFunction>(fn);
     int ret = thread_main(arg);
     MicroFiber::thread_exit(ret);
 }
 
+// A thread that exits as soon as it starts runs this on the fallback stack, with its exit code in code. It is off that
+// stack once it exits, before the next thread needing it is switched to.
+static void thread_stub_exit(void *code, void *unused) {
+    (void) unused;
+    current_thread->started = true;
+    MicroFiber::thread_exit(static_cast<int>(reinterpret_cast<intptr_t>(code)));
+}
+
+// Set up the context of a thread about to run for the first time, mapping its stack. A thread killed before it first
+// ran exits right away, which needs no stack of its own.
+static void thread_map_stack(Thread *t) {
+    void *stack = nullptr;
+    bool killed = t->state == Thread::State::KILLED;
+    if (!killed) {
+        stack = stack_pool_alloc(t->stack_size, t->node);
+    }
+    if (stack == nullptr) {
+        auto code = killed ? MicroFiber::ThreadCodes::KILLED : MicroFiber::ThreadCodes::NO_MEMORY;
+        context_make(&t->context, fallback_stack, FALLBACK_STACK_SIZE, thread_stub_exit,
+                     reinterpret_cast<void *>(static_cast<intptr_t>(code)), nullptr);
+        return;
+    }
+    context_make(&t->context, stack, t->stack_size, thread_stub, reinterpret_cast<void *>(t->fn), t->arg);
+    t->stack = stack;
+}
+
 ThreadID MicroFiber::thread_create(const ThreadFunction &fn, void *arg, int priority) {
-    int enabled = InterruptManager::interrupt_off();
+    return thread_create(fn, arg, priority, nullptr);
+}
 
-    if (thread_count >= MAX_THREAD_COUNT) {
-        InterruptManager::interrupt_set(enabled);
-        return static_cast<ThreadID>(ThreadCodes::MAX_THREADS);
+ThreadID MicroFiber::thread_create(const ThreadFunction &fn, void *arg, int priority, const ThreadAttr *attr) {
+    return thread_create_with(*scheduler, fn, arg, priority, attr);
+}
+
+Thread *thread_alloc(const MicroFiber::ThreadFunction &fn, void *arg, int priority, const ThreadAttr *attr,
+                     ThreadID *error) {
+    if (thread_count.fetch_add(1, std::memory_order_relaxed) >= max_thread_count) {
+        thread_count.fetch_sub(1, std::memory_order_relaxed);
+        *error = static_cast<ThreadID>(MicroFiber::ThreadCodes::MAX_THREADS);
+        return nullptr;
     }
 
-    ThreadID tid = -1;
-    for (int i = 0; i < MAX_THREAD_COUNT; i++) {
-        if (!thread_array[i].initialized) {
-            tid = i;
-            break;
-        }
+    // Placed first, so that the thread's record and stack come from its worker's node
+    Worker *worker = worker_place();
+    Thread *new_thread = free_thread_pop(worker->node);
+    if (new_thread == nullptr) {
+        thread_count.fetch_sub(1, std::memory_order_relaxed);
+        *error = static_cast<ThreadID>(MicroFiber::ThreadCodes::NO_MEMORY);
+        return nullptr;
     }
-    assert(tid != -1);
+    assert(!new_thread->initialized);
 
-    Thread *new_thread = &thread_array[tid];
-    new_thread->id = tid;
     new_thread->next = nullptr;
-    new_thread->in_queue = false;
-    new_thread->initialized = true;
-    new_thread->setcontext_called = false;
-    new_thread->wait_queue = new FifoQueue(MAX_THREAD_COUNT);
+    new_thread->prev = nullptr;
+    new_thread->queue = nullptr;
+    new_thread->timer_next = nullptr;
+    new_thread->timer_pprev = nullptr;
+    new_thread->io_fd = -1;
+    new_thread->uring_pending = false;
+    new_thread->offload_pending = false;
+    new_thread->wake_wait = nullptr;
+    new_thread->park_addr = nullptr;
+    new_thread->started = false;
     new_thread->num_reapers = 0;
-    new_thread->member_of = nullptr;
     new_thread->state = Thread::State::READY;
     new_thread->prio = priority;
+    new_thread->worker = worker;
 
-    getcontext(&(new_thread->context));
-
-    void *stack = malloc(MIN_STACK_SIZE + 16);
-    if (stack == nullptr) {
-        new_thread->initialized = false;
-        InterruptManager::interrupt_set(enabled);
-        return static_cast<ThreadID>(ThreadCodes::NO_MEMORY);
+    // The stack is mapped when the thread first runs, so a thread waiting for its first turn costs only its record
+    size_t stack_size = MIN_STACK_SIZE;
+    if (attr != nullptr && attr->stack_size > stack_size) {
+        stack_size = attr->stack_size;
     }
-    unsigned long stack_top = (unsigned long) stack + MIN_STACK_SIZE + 8;
-
-    new_thread->context.uc_mcontext.gregs[REG_RSP] = (greg_t) stack_top;
-    new_thread->context.uc_mcontext.gregs[REG_RIP] = (greg_t) thread_stub;
-    new_thread->context.uc_mcontext.gregs[REG_RDI] = (greg_t) fn;
-    new_thread->context.uc_mcontext.gregs[REG_RSI] = (greg_t) arg;
-    new_thread->stack = stack;
-
-    thread_count++;
-
-    assert(scheduler->enqueue(new_thread) == 0);
-    if (scheduler->is_realtime()) {
-        thread_yield(static_cast<ThreadID>(ThreadCodes::ANY));
-    }
-
-    InterruptManager::interrupt_set(enabled);
-    return new_thread->id;
+    new_thread->stack = nullptr;
+    new_thread->stack_size = stack_pool_round(stack_size);
+    new_thread->fn = fn;
+    new_thread->arg = arg;
+
+    // Last, a reaper with a stale id may look at the record as soon as it is set
+    new_thread->initialized.store(true, std::memory_order_release);
+    return new_thread;
 }
 
-// Clean up a thread structure and make the thread id available for reuse
+// Clean up a thread structure and make the thread id available for reuse. Its last reaper has already marked it
+// uninitialized under the wait lock, so no other reaper gets to it.
 static void thread_destroy(Thread *dead) {
     int enabled = InterruptManager::interrupt_off();
 
     assert(dead != nullptr);
-    assert(!dead->in_queue);
-    assert(dead->state == Thread::State::EXITED || dead->state == Thread::State::KILLED);
+    assert(!dead->initialized);
+    assert(!FifoQueue::node_in_queue(dead));
+    assert(dead->timer_pprev == nullptr);
+    assert(dead->io_fd < 0);
+    assert(!dead->uring_pending);
+    assert(!dead->offload_pending);
+    assert(dead->wake_wait == nullptr);
+    assert(dead->wait_queue.count() == 0);
+    assert(dead->state == Thread::State::EXITED);
 
     if (dead->stack != nullptr) {
-        free(dead->stack);
+        stack_pool_free(dead->stack, dead->stack_size, dead->node);
         dead->stack = nullptr;
     }
-    dead->initialized = false;
     dead->state = Thread::State::DEAD;
-    dead->member_of = nullptr;
-    delete dead->wait_queue;
+    free_thread_give(dead);
 
-    thread_count--;
+    thread_count.fetch_sub(1, std::memory_order_relaxed);
     InterruptManager::interrupt_set(enabled);
 }
 
-// Context switch to the next thread
-static void thread_switch(Thread *next) {
-    assert(next != nullptr);
-    assert(next != current_thread);
+void thread_unwait(Thread *thread) {
+    thread->lock.lock();
+
+    // The queue is only ever cleared once the thread is claimed, by a waker that lost the claim popping it
+    FifoQueue *queue;
+    while ((queue = __atomic_load_n(&thread->queue, __ATOMIC_RELAXED)) != nullptr) {
+        WordLock &lock = wait_lock(queue);
+        lock.lock();
+        bool found = thread->queue == queue;
+        if (found) {
+            queue->remove(thread);
+        }
+        lock.unlock();
+        if (found) {
+            break;
+        }
+    }
+    thread->park_addr = nullptr;
+    event_loop_cancel(thread);
+    timer_wheel_cancel(thread);
+    wake_cancel(thread);
 
-    getcontext(&current_thread->context);
+    thread->lock.unlock();
+}
 
-    if (current_thread->setcontext_called && current_thread->state != Thread::State::KILLED &&
-        current_thread->state != Thread::State::EXITED) {
-        current_thread->setcontext_called = false;
-        return;
+// Make next the running thread and switch to it, saving the current context in save
+static void thread_enter(Thread *next, Context *save) {
+    current_thread = next;
+    // A killed thread stays KILLED, and the idle fiber is always RUNNING
+    Thread::State ready = Thread::State::READY;
+    next->state.compare_exchange_strong(ready, Thread::State::RUNNING);
+    if (!next->started && next->stack == nullptr) {
+        thread_map_stack(next);
     }
 
-    current_thread->setcontext_called = true;
-    current_thread = next;
+    context_switch(save, &next->context);
+}
+
+void thread_switch(Thread *next) {
+    assert(next != nullptr);
+    assert(next != current_thread);
+
+    Thread *prev = current_thread;
+    thread_enter(next, &prev->context);
 
+    // We are running again as prev, exit right away if another thread killed us in the meantime
     if (current_thread->state == Thread::State::KILLED) {
         MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
         assert(0);
-    } else {
-        current_thread->state = Thread::State::RUNNING;
-        setcontext(&current_thread->context);
-        assert(0);
     }
 }
 
 ThreadID MicroFiber::thread_yield(ThreadID want_tid) {
-    int enabled = InterruptManager::interrupt_off();
-
-    Thread *next_thread;
-
-    if (want_tid == get_thread_id()) {
-        assert(thread_runnable(want_tid));
-        InterruptManager::interrupt_set(enabled);
-        return want_tid;
-    }
+    return thread_yield_with(*scheduler, want_tid);
+}
 
-    if (want_tid == static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY)) {
-        next_thread = scheduler->dequeue();
-        if (next_thread == nullptr) {
-            InterruptManager::interrupt_set(enabled);
-            return static_cast<ThreadID>(MicroFiber::ThreadCodes::NONE);
-        }
-        if (next_thread->prio > current_thread->prio && thread_runnable(get_thread_id())) {
-            assert(scheduler->enqueue(next_thread) == 0);
-            InterruptManager::interrupt_set(enabled);
-            return current_thread->id;
-        }
-    } else {
-        next_thread = scheduler->remove(want_tid);
-        if (next_thread == nullptr) {
-            InterruptManager::interrupt_set(enabled);
-            return static_cast<ThreadID>(MicroFiber::ThreadCodes::INVALID);
+// The end of thread_exit, on the exit stack of the worker. The thread is marked EXITED and its reapers woken only now,
+// as from then on a reaper may destroy it. Until the next thread runs, the worker runs as its idle fiber, whose context
+// is left as it is.
+[[noreturn]] static void thread_finish(void *arg, void *unused) {
+    (void) unused;
+    auto *dying = static_cast<Thread *>(arg);
+    int exit_code = dying->exit_code;
+    current_thread = &this_worker->idle;
+
+    WordLock &lock = wait_lock(&dying->wait_queue);
+    WokenList reapers;
+    lock.lock();
+    dying->state = Thread::State::EXITED;
+    while (Thread *reaper = dying->wait_queue.pop()) {
+        if (thread_claim(reaper)) {
+            reapers.push(reaper);
         }
     }
+    lock.unlock();
+    reapers.ready(*scheduler);
 
-    assert(next_thread != current_thread);
-    if (thread_runnable(get_thread_id())) {
-        if (current_thread->state == Thread::State::RUNNING) {
-            current_thread->state = Thread::State::READY;
-        }
-        assert(scheduler->enqueue(current_thread) == 0);
+    Thread *next = thread_next(*scheduler, true);
+    if (next == nullptr) {
+        runtime_exit(exit_code);
     }
-
-    thread_switch(next_thread);
-    InterruptManager::interrupt_set(enabled);
-
-    return next_thread->id;
+    Context discarded{};
+    thread_enter(next, &discarded);
+    assert(false);
+    __builtin_unreachable();
 }
 
 void MicroFiber::thread_exit(int exit_code) {
-    assert(current_thread->state != Thread::State::EXITED);
-    current_thread->state = Thread::State::EXITED;
-    current_thread->exit_code = exit_code;
+    // Preemption stays disabled until the next thread runs
+    InterruptManager::interrupt_off();
 
-    assert(current_thread->wait_queue != nullptr);
-    thread_wakeup(current_thread->wait_queue, true);
-
-    if (thread_yield(static_cast<ThreadID>(ThreadCodes::ANY)) == static_cast<ThreadID>(ThreadCodes::NONE)) {
-        InterruptManager::interrupt_off();
-        microfiber_exit(exit_code);
-    }
+    Thread *curr = current_thread;
+    assert(curr->state != Thread::State::EXITED);
+    curr->exit_code = exit_code;
+    last_exit_code.store(exit_code, std::memory_order_relaxed);
 
+    Context finish{}, discarded{};
+    context_make(&finish, exit_stack, FALLBACK_STACK_SIZE, thread_finish, curr, nullptr);
+    context_switch(&discarded, &finish);
     assert(false);
+    __builtin_unreachable();
 }
 
 ThreadID MicroFiber::thread_kill(ThreadID tid) {
     int enabled = InterruptManager::interrupt_off();
 
     Thread *victim = thread_get(tid);
-    if (victim == nullptr || tid == current_thread->id || !victim->initialized) {
+    if (victim == nullptr || tid == current_thread->id) {
         InterruptManager::interrupt_set(enabled);
         return static_cast<ThreadID>(ThreadCodes::INVALID);
     }
 
-    if (victim->state == Thread::State::EXITED) {
-        InterruptManager::interrupt_set(enabled);
-        return tid;
-    }
-
-    if (victim->state == Thread::State::BLOCKED) {
-        assert(victim->member_of != nullptr);
-        assert(victim->member_of->wait_queue != nullptr);
-        victim->member_of->wait_queue->remove(victim->id);
-        victim->state = Thread::State::KILLED;
+    Thread::State state = victim->state;
+    while (true) {
+        if (state == Thread::State::DEAD) {
+            InterruptManager::interrupt_set(enabled);
+            return static_cast<ThreadID>(ThreadCodes::INVALID);
+        }
+        if (state == Thread::State::EXITED || state == Thread::State::KILLED) {
+            break;
+        }
+        if (!victim->state.compare_exchange_weak(state, Thread::State::KILLED)) {
+            continue;
+        }
 
-        assert(scheduler->enqueue(victim) == 0);
-        if (scheduler->is_realtime()) {
-            thread_yield(static_cast<ThreadID>(ThreadCodes::ANY));
+        if (state == Thread::State::IO_BLOCKED) {
+            // The kernel or an offload worker may still write into the victim's buffers, so it only runs, and exits,
+            // once the operation has completed. An io_uring operation can be cancelled to make that happen soon, a
+            // running offloaded call cannot be stopped.
+            uring_cancel(victim);
+        } else if (state == Thread::State::BLOCKED) {
+            // Blocked threads are in the wait queue they sleep on, whether it belongs to a thread or an fd or is a
+            // bucket of the parking lot, or in the timing wheel, or both, or wait on a wake handle
+            thread_unwait(victim);
+            thread_ready(*scheduler, victim);
+            if (scheduler->is_realtime()) {
+                thread_yield(static_cast<ThreadID>(ThreadCodes::ANY));
+            }
         }
-    } else {
-        victim->state = Thread::State::KILLED;
+        break;
     }
 
     InterruptManager::interrupt_set(enabled);
@@ -259,22 +498,33 @@ ThreadID MicroFiber::thread_kill(ThreadID tid) {
 }
 
 void thread_end() {
-    for (int i = 0; i < MAX_THREAD_COUNT; i++) {
-        Thread *t = &thread_array[i];
-        if (t->initialized) {
+    size_t count = thread_chunk_count.load(std::memory_order_relaxed);
+    for (size_t c = 0; c < count; c++) {
+        Thread *chunk = thread_chunks[c].load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < THREAD_CHUNK_SIZE; i++) {
+            Thread *t = &chunk[i];
+            if (!t->initialized) continue;
+
             if (t->stack != nullptr) {
-                free(t->stack);
+                stack_pool_free(t->stack, t->stack_size, t->node);
                 t->stack = nullptr;
             }
             t->initialized = false;
             t->state = Thread::State::DEAD;
-            t->member_of = nullptr;
-            delete t->wait_queue;
         }
+        thread_chunk_unmap(chunk);
     }
 
+    if (thread_chunks != nullptr) {
+        munmap(thread_chunks, THREAD_CHUNKS_MAX * sizeof(std::atomic<Thread *>));
+        thread_chunks = nullptr;
+    }
+    thread_chunk_count.store(0, std::memory_order_relaxed);
     thread_count = 0;
     current_thread = nullptr;
+    free_threads.clear();
+    slot_cache = nullptr;
+    slot_cache_count = 0;
 }
 
 void MicroFiber::set_thread_priority(int priority) {
@@ -288,6 +538,8 @@ void MicroFiber::set_thread_priority(int priority) {
     InterruptManager::interrupt_set(enabled);
 }
 
+// The exit state of a thread (EXITED, exit_code, num_reapers, wait_queue) is guarded by the wait lock of its wait
+// queue. The reaper that leaves last marks the thread uninitialized under it and destroys it.
 ThreadID MicroFiber::thread_wait(ThreadID tid, int *exit_code) {
     int enabled = InterruptManager::interrupt_off();
 
@@ -297,7 +549,17 @@ ThreadID MicroFiber::thread_wait(ThreadID tid, int *exit_code) {
         return static_cast<ThreadID>(ThreadCodes::INVALID);
     }
 
-    if (target_thread->state == Thread::State::EXITED && target_thread->num_reapers > 0) {
+    Thread *curr = current_thread;
+    if (!thread_wait_begin()) {
+        thread_exit(static_cast<int>(ThreadCodes::KILLED));
+    }
+    WordLock &lock = wait_lock(&target_thread->wait_queue);
+    lock.lock();
+    if (!target_thread->initialized ||
+        (target_thread->state == Thread::State::EXITED && target_thread->num_reapers > 0)) {
+        lock.unlock();
+        thread_wait_end();
+        thread_block_abort(*scheduler);
         InterruptManager::interrupt_set(enabled);
         return static_cast<ThreadID>(ThreadCodes::INVALID);
     }
@@ -306,27 +568,32 @@ ThreadID MicroFiber::thread_wait(ThreadID tid, int *exit_code) {
         if (exit_code != nullptr) {
             *exit_code = target_thread->exit_code;
         }
+        target_thread->initialized = false;
+        lock.unlock();
+        thread_wait_end();
         thread_destroy(target_thread);
+        thread_block_abort(*scheduler);
         InterruptManager::interrupt_set(enabled);
         return 0;
     }
 
-    assert(target_thread->wait_queue != nullptr);
-    assert(target_thread->state != Thread::State::EXITED);
-
     target_thread->num_reapers++;
-    current_thread->member_of = target_thread;
-
-    thread_sleep(target_thread->wait_queue);
+    target_thread->wait_queue.push(curr);
+    lock.unlock();
+    thread_wait_end();
+    thread_block_with(*scheduler);
 
+    lock.lock();
     assert(target_thread->state == Thread::State::EXITED);
-
     if (exit_code != nullptr) {
         *exit_code = target_thread->exit_code;
     }
-
-    target_thread->num_reapers--;
-    if (target_thread->num_reapers == 0) {
+    bool last = --target_thread->num_reapers == 0;
+    if (last) {
+        target_thread->initialized = false;
+    }
+    lock.unlock();
+    if (last) {
         thread_destroy(target_thread);
     }
 
@@ -335,122 +602,21 @@ ThreadID MicroFiber::thread_wait(ThreadID tid, int *exit_code) {
 }
 
 ThreadID MicroFiber::thread_sleep(FifoQueue *queue) {
-    int enabled = InterruptManager::interrupt_off();
-
-    if (queue == nullptr) {
-        InterruptManager::interrupt_set(enabled);
-        return static_cast<ThreadID>(ThreadCodes::INVALID);
-    }
-
-    Thread *next = scheduler->dequeue();
-    if (next == nullptr) {
-        InterruptManager::interrupt_set(enabled);
-        return static_cast<ThreadID>(ThreadCodes::NONE);
-    }
-
-    Thread *curr = current_thread;
-    curr->state = Thread::State::BLOCKED;
-    queue->push(curr);
-
-    ThreadID ret = next->id;
-
-    thread_switch(next);
-
-    InterruptManager::interrupt_set(enabled);
-    return ret;
+    return thread_sleep_with(*scheduler, queue);
 }
 
-ThreadID MicroFiber::thread_wakeup(FifoQueue *queue, bool wake_all) {
-    int enabled = InterruptManager::interrupt_off();
-    int num_woken = 0;
-
-    if (queue == nullptr || queue->count() == 0) {
-        InterruptManager::interrupt_set(enabled);
-        return 0;
-    }
-
-    if (wake_all == 0) {
-        Thread *woken = queue->pop();
-        assert(woken != nullptr);
-        if (woken->state != Thread::State::KILLED) {
-            woken->state = Thread::State::READY;
-        }
-        assert(scheduler->enqueue(woken) == 0);
-        if (scheduler->is_realtime()) {
-            thread_yield(static_cast<ThreadID>(ThreadCodes::ANY));
-        }
-        num_woken++;
-    } else {
-        while (queue->count() > 0) {
-            Thread *woken = queue->pop();
-            assert(woken != nullptr);
-            if (woken->state != Thread::State::KILLED) {
-                woken->state = Thread::State::READY;
-            }
-            assert(scheduler->enqueue(woken) == 0);
-            if (scheduler->is_realtime()) {
-                thread_yield(static_cast<ThreadID>(ThreadCodes::ANY));
-            }
-            num_woken++;
-        }
-    }
-
-    InterruptManager::interrupt_set(enabled);
-    return num_woken;
-}
-
-
-//////////////////////
-/* LOCK OPERATIONS */
-//////////////////////
-
-Lock::Lock() {
-    flag = 0;
-    owner = nullptr;
-    wait_queue = new FifoQueue(MAX_THREAD_COUNT);
+void MicroFiber::thread_sleep_for(uint64_t microseconds) {
+    thread_sleep_until(timer_now_us() + microseconds);
 }
 
-Lock::~Lock() {
-    assert(flag == 0);
-    assert(owner == nullptr);
-    assert(wait_queue != nullptr);
-    delete wait_queue;
+void MicroFiber::thread_sleep_until(uint64_t deadline_us) {
+    thread_sleep_until_with(*scheduler, deadline_us);
 }
 
-void Lock::acquire() {
-    int enabled = InterruptManager::interrupt_off();
-
-    while (flag == 1) {
-        wait_queue->push(current_thread);
-        current_thread->state = Thread::State::BLOCKED;
-        MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
-    }
-
-    flag = 1;
-    owner = current_thread;
-
-    InterruptManager::interrupt_set(enabled);
+uint64_t MicroFiber::get_time_us() {
+    return timer_now_us();
 }
 
-void Lock::release() {
-    int enabled = InterruptManager::interrupt_off();
-
-    assert(flag == 1);
-    assert(owner == current_thread);
-
-    flag = 0;
-    owner = nullptr;
-
-    if (wait_queue->count() > 0) {
-        Thread *next = wait_queue->pop();
-        assert(next != nullptr);
-        assert(next->state == Thread::State::BLOCKED);
-        next->state = Thread::State::READY;
-        assert(scheduler->enqueue(next) == 0);
-        if (scheduler->is_realtime()) {
-            MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
-        }
-    }
-
-    InterruptManager::interrupt_set(enabled);
+int MicroFiber::thread_wakeup(FifoQueue *queue, bool wake_all) {
+    return thread_wakeup_with(*scheduler, queue, wake_all);
 }
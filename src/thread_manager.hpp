@@ -1,40 +1,130 @@
 #ifndef MICROFIBER_THREAD_MANAGER_H
 #define MICROFIBER_THREAD_MANAGER_H
 
-#include <csignal>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include "microfiber.hpp"
+#include "context.hpp"
+#include "queue.hpp"
+#include "word_lock.hpp"
 
 using ThreadID = int;
 
-class FifoQueue;
+struct Worker;
 
-class Thread {
+// Size of a cache line on the targets we run on
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Each thread starts on its own cache line. The fields read and written by the scheduler and the queues come first and
+// fit in that line, the rest are only touched on create, exit and wait. The saved registers live on the thread's stack.
+//
+// The state is changed with compare-and-swap, so that a wait ends exactly once however many workers try to end it:
+// - A thread about to wait takes its own lock and moves itself from RUNNING to BLOCKED, or to IO_BLOCKED for an
+//   operation the kernel or the offload pool runs on its buffers, and registers with whatever will end the wait before
+//   it releases the lock.
+// - Whatever ends a BLOCKED wait claims the thread by moving it to READY, under the lock of its own structure, then
+//   withdraws its other registrations with thread_unwait and makes it ready. One whose claim fails only takes the
+//   thread off its own structure.
+// - A killer claims a BLOCKED thread the same way, moving it to KILLED. An IO_BLOCKED thread it only marks KILLED,
+//   the completion still makes it ready; a READY or RUNNING one exits at its next switch.
+class alignas(CACHE_LINE_SIZE) Thread {
 public:
-    enum class State {
-        RUNNING, READY, BLOCKED, KILLED, EXITED, DEAD
+    enum class State : uint8_t {
+        RUNNING, READY, BLOCKED, IO_BLOCKED, KILLED, EXITED, DEAD
     };
 
-    // Thread members
+    // Queue node members
+    struct Thread *next;        // pointer to the next node
+    struct Thread *prev;        // pointer to the previous node
+    FifoQueue *queue;           // the queue this thread is in, or nullptr
+
+    // Scheduling members
+    std::atomic<State> state;   // the thread's state
+    std::atomic<bool> initialized;  // flag to determine if the thread is initialized
+    bool started;               // whether the thread has run, a thread that has not may move to another worker
     ThreadID id;                // the thread's id
-    bool initialized;           // flag to determine if the thread is initialized
-    ucontext_t context;         // the thread's context
-    int exit_code;              // the thread's exit code
-    void *stack;                // the stack pointer
-    bool setcontext_called;     // identify if the thread called setcontext
-    FifoQueue *wait_queue;      // wait queue associated with the thread (threads that called thread_wait on this thread)
-    int num_reapers;            // number of threads that are reaping this thread
-    struct Thread *member_of;   // the thread that this thread is a wait queue member of
     int prio;                   // the thread's priority
-    State state;                // the thread's state
+    unsigned ready_index;       // position in the ready vector of the Random and Lottery schedulers
+    Context context;            // the thread's saved context
+    struct Worker *worker;      // the worker whose run queue the thread is made ready on
 
-    // Queue node members
-    struct Thread *next;        // pointer to the next node
-    bool in_queue;              // indicates whether the item is in a queue
+    // Cold members
+    void *stack;                // the stack pointer, nullptr until the thread first runs
+    size_t stack_size;          // size of the stack allocation
+    int node;                   // NUMA node the thread's record and stack are placed on
+    WordLock lock;              // held while the thread registers a wait, and by thread_unwait
+    FifoQueue wait_queue;       // threads waiting in thread_wait for this one, embedded so that it allocates nothing
+    int exit_code;              // the thread's exit code, guarded with num_reapers by the wait lock of wait_queue
+    int num_reapers;            // number of threads that are reaping this thread
+
+    // Timing wheel members
+    struct Thread *timer_next;  // next thread in the same timing wheel slot
+    struct Thread **timer_pprev;// link pointing at this thread in its slot, or nullptr if no timer is pending
+    uint64_t timer_expires;     // tick at which the pending timer expires
+    uint16_t timer_slot;        // timing wheel slot the pending timer is in
+
+    // Event loop members
+    int io_fd;                  // file descriptor the thread waits on, or -1
+    short io_revents;           // events that ended the wait
+    bool uring_pending;         // whether an io_uring operation of the thread has not completed yet
+    int io_result;              // result of the last io_uring operation, a negative errno on failure
+    bool offload_pending;       // whether a job the thread offloaded has not been collected yet
+    std::atomic<uint32_t> deque_mark;   // odd while in a WorkDeque and not taken yet, see WorkDeque
+    WakeHandle *wake_wait;      // the wake handle the thread waits on, or nullptr
+    const void *park_addr;      // the address the thread is parked on in the parking lot, or nullptr
+
+    // Entry point, kept until the thread first runs and its stack is mapped
+    MicroFiber::ThreadFunction fn;
+    void *arg;
 };
 
+static_assert(offsetof(Thread, stack) <= CACHE_LINE_SIZE, "hot Thread members must fit in one cache line");
+
+// The thread running on the calling worker
+extern thread_local Thread *current_thread;
+
+// Exit code of the thread that exited last, the exit status of the process once no thread is left to run
+extern std::atomic<int> last_exit_code;
+
+// The lock of a wait queue. The queues threads wait on (those of thread_sleep, thread_wait and the fds, the buckets of
+// the parking lot) have no lock of their own: each is guarded by the one its address hashes to in a fixed table.
+// Nothing else is taken while one is held.
+WordLock &wait_lock(const FifoQueue *queue);
+
+// Claim a thread waiting in state from for whoever ends the wait. Fails if something else ended it first, or killed
+// the thread.
+inline bool thread_claim(Thread *thread, Thread::State from = Thread::State::BLOCKED) {
+    return thread->state.compare_exchange_strong(from, Thread::State::READY);
+}
+
+// Withdraw every registration of a claimed thread: take it off the wait queue it is still on, cancel its timer, its
+// fd wait and its wait on a wake handle. Called with no lock held, before the thread is made ready.
+void thread_unwait(Thread *thread);
+
 // Forward declarations of functions
-void thread_init();
+void thread_init(unsigned max_threads);
 
 void thread_end();
 
+// Get the thread structure by ID, or nullptr if no such thread exists
+Thread *thread_get(ThreadID tid);
+
+// Check if the thread is runnable
+bool thread_runnable(ThreadID tid);
+
+// Set up a new READY thread running fn(arg) without enqueueing it. On failure returns nullptr and stores the
+// MAX_THREADS or NO_MEMORY code in error. Must be called with interrupts disabled.
+Thread *thread_alloc(const MicroFiber::ThreadFunction &fn, void *arg, int priority, const ThreadAttr *attr,
+                     ThreadID *error);
+
+// Context switch to the next thread. Must be called with interrupts disabled.
+void thread_switch(Thread *next);
+
+// Start the runtime once a scheduler has been installed, shared by MicroFiber and StaticMicroFiber
+void runtime_start(const Config *config);
+
+// Tear the runtime down and exit the process with the given status, from any thread of worker 0
+[[noreturn]] void runtime_exit(int code);
+
 #endif //MICROFIBER_THREAD_MANAGER_H
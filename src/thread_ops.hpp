@@ -0,0 +1,364 @@
+#ifndef MICROFIBER_THREAD_OPS_H
+#define MICROFIBER_THREAD_OPS_H
+
+#include <cassert>
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "thread_manager.hpp"
+#include "timer_wheel.hpp"
+#include "event_loop.hpp"
+#include "worker.hpp"
+
+// The scheduling paths of the runtime, written once against a scheduler type. MicroFiber instantiates them with the
+// polymorphic Scheduler selected at runtime, StaticMicroFiber<Policy> with a policy known at compile time so that the
+// run-queue operations are inlined. Sched must provide enqueue, dequeue, remove, is_realtime and weighs_priority.
+
+// Make a thread runnable. The run queues are unbounded, so this cannot fail. A ready thread competes with the running
+// one, so preemption has to be on. A thread of another worker goes to that worker's queue, and a thread that other
+// workers may steal wakes one of them.
+template<class Sched>
+inline void thread_ready(Sched &sched, Thread *thread) {
+    if (thread->worker != this_worker) {
+        worker_ready_remote(thread);
+        return;
+    }
+    int ret = sched.enqueue(thread);
+    assert(ret == 0);
+    (void) ret;
+    InterruptManager::timer_arm();
+    worker_offer(thread);
+}
+
+// Pick the next thread to run after making the threads whose timer expired, whose fd is ready or that other workers
+// woke runnable. If none is ready and the caller cannot go on running, wait in the kernel for a timer or an fd rather
+// than give up while other threads still wait for one. With several workers the worker's idle fiber does the waiting
+// instead, so that the caller's stack is free once the switch is done.
+template<class Sched>
+Thread *thread_next(Sched &sched, bool can_idle) {
+    timer_wheel_poll();
+    event_loop_poll();
+    worker_poll_inbox();
+    Thread *next = sched.dequeue();
+    if (next == nullptr && !can_idle && event_loop_pending()) {
+        event_loop_wait(false);
+        next = sched.dequeue();
+    }
+    if (next == nullptr && can_idle && multi_worker()) {
+        return &this_worker->idle;
+    }
+    while (next == nullptr && can_idle && (timer_wheel_pending() || event_loop_pending())) {
+        event_loop_wait(true);
+        next = sched.dequeue();
+    }
+    return next;
+}
+
+// Switch away from the current thread, which has registered itself with whatever will make it ready again and released
+// its lock. With nothing else to run the wait happens right here, and the thread may find itself ready first, or
+// killed.
+template<class Sched>
+void thread_block_with(Sched &sched) {
+    Thread *curr = current_thread;
+    Thread *next = thread_next(sched, true);
+    assert(next != nullptr);
+    if (next != curr) {
+        thread_switch(next);
+        return;
+    }
+    Thread::State ready = Thread::State::READY;
+    if (!curr->state.compare_exchange_strong(ready, Thread::State::RUNNING)) {
+        MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    }
+}
+
+// Take the current thread's lock and mark it BLOCKED, it registers its wait under the lock before thread_wait_end.
+// Returns false, with nothing done, if the thread was killed while it ran. A killer that gets in from now on waits for
+// the lock to end the wait, and the thread exits once it blocks.
+inline bool thread_wait_begin() {
+    Thread *curr = current_thread;
+    curr->lock.lock();
+    Thread::State running = Thread::State::RUNNING;
+    if (!curr->state.compare_exchange_strong(running, Thread::State::BLOCKED)) {
+        curr->lock.unlock();
+        return false;
+    }
+    return true;
+}
+
+inline void thread_wait_end() {
+    current_thread->lock.unlock();
+}
+
+// Called instead of thread_block_with by a thread that marked itself BLOCKED but will not wait after all, once it has
+// withdrawn what it registered. Something that claimed it meanwhile makes it ready, which it waits for.
+template<class Sched>
+void thread_block_abort(Sched &sched) {
+    Thread::State blocked = Thread::State::BLOCKED;
+    if (!current_thread->state.compare_exchange_strong(blocked, Thread::State::RUNNING)) {
+        thread_block_with(sched);
+    }
+}
+
+// Threads claimed under the lock of what they waited on, made ready in the order they were claimed once it is
+// released. Linked through next, as they are on no queue by then.
+class WokenList {
+public:
+    void push(Thread *thread) {
+        thread->next = nullptr;
+        *tail = thread;
+        tail = &thread->next;
+    }
+
+    Thread *pop() {
+        Thread *thread = head;
+        if (thread != nullptr) {
+            head = thread->next;
+            thread->next = nullptr;
+            if (head == nullptr) {
+                tail = &head;
+            }
+        }
+        return thread;
+    }
+
+    // Make every thread of the list ready, returns how many
+    template<class Sched>
+    unsigned ready(Sched &sched) {
+        unsigned woken = 0;
+        while (Thread *thread = pop()) {
+            thread_unwait(thread);
+            thread_ready(sched, thread);
+            woken++;
+        }
+        return woken;
+    }
+
+private:
+    Thread *head = nullptr;
+    Thread **tail = &head;
+};
+
+template<class Sched>
+ThreadID thread_yield_with(Sched &sched, ThreadID want_tid) {
+    int enabled = InterruptManager::interrupt_off();
+
+    Thread *next_thread;
+
+    if (want_tid == current_thread->id) {
+        assert(thread_runnable(want_tid));
+        InterruptManager::interrupt_set(enabled);
+        return want_tid;
+    }
+
+    if (want_tid == static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY)) {
+        next_thread = thread_next(sched, !thread_runnable(current_thread->id));
+        if (next_thread == nullptr) {
+            InterruptManager::interrupt_set(enabled);
+            return static_cast<ThreadID>(MicroFiber::ThreadCodes::NONE);
+        }
+        // Never hand the CPU to a lower-priority thread, unless the scheduler weighs priority in its pick itself, as
+        // the Lottery scheduler does: its draw already gave every thread its share
+        if (!sched.weighs_priority() && next_thread->prio > current_thread->prio &&
+            thread_runnable(current_thread->id)) {
+            thread_ready(sched, next_thread);
+            InterruptManager::interrupt_set(enabled);
+            return current_thread->id;
+        }
+    } else {
+        next_thread = sched.remove(want_tid);
+        if (next_thread == nullptr) {
+            InterruptManager::interrupt_set(enabled);
+            return static_cast<ThreadID>(MicroFiber::ThreadCodes::INVALID);
+        }
+    }
+
+    assert(next_thread != current_thread);
+    if (thread_runnable(current_thread->id)) {
+        // A killed thread stays KILLED, and exits once it is switched back to
+        Thread::State running = Thread::State::RUNNING;
+        current_thread->state.compare_exchange_strong(running, Thread::State::READY);
+        thread_ready(sched, current_thread);
+    }
+
+    thread_switch(next_thread);
+    InterruptManager::interrupt_set(enabled);
+
+    return next_thread->id;
+}
+
+template<class Sched>
+ThreadID thread_create_with(Sched &sched, const MicroFiber::ThreadFunction &fn, void *arg, int priority,
+                            const ThreadAttr *attr) {
+    int enabled = InterruptManager::interrupt_off();
+
+    ThreadID error;
+    Thread *new_thread = thread_alloc(fn, arg, priority, attr, &error);
+    if (new_thread == nullptr) {
+        InterruptManager::interrupt_set(enabled);
+        return error;
+    }
+
+    thread_ready(sched, new_thread);
+    if (sched.is_realtime()) {
+        thread_yield_with(sched, static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    }
+
+    InterruptManager::interrupt_set(enabled);
+    return new_thread->id;
+}
+
+template<class Sched>
+ThreadID thread_sleep_with(Sched &sched, FifoQueue *queue) {
+    int enabled = InterruptManager::interrupt_off();
+
+    if (queue == nullptr) {
+        InterruptManager::interrupt_set(enabled);
+        return static_cast<ThreadID>(MicroFiber::ThreadCodes::INVALID);
+    }
+
+    Thread *curr = current_thread;
+    if (!thread_wait_begin()) {
+        MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    }
+    WordLock &lock = wait_lock(queue);
+    lock.lock();
+    queue->push(curr);
+    lock.unlock();
+    thread_wait_end();
+
+    Thread *next = thread_next(sched, true);
+    if (next == nullptr) {
+        // No other thread is left, so none can wake this one either
+        lock.lock();
+        if (curr->queue == queue) {
+            queue->remove(curr);
+        }
+        lock.unlock();
+        thread_block_abort(sched);
+        InterruptManager::interrupt_set(enabled);
+        return static_cast<ThreadID>(MicroFiber::ThreadCodes::NONE);
+    }
+
+    ThreadID ret = next->id;
+    if (next != curr) {
+        thread_switch(next);
+    } else {
+        Thread::State ready = Thread::State::READY;
+        if (!curr->state.compare_exchange_strong(ready, Thread::State::RUNNING)) {
+            MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+        }
+    }
+
+    InterruptManager::interrupt_set(enabled);
+    return ret;
+}
+
+template<class Sched>
+void thread_sleep_until_with(Sched &sched, uint64_t deadline_us) {
+    int enabled = InterruptManager::interrupt_off();
+
+    if (!thread_wait_begin()) {
+        MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    }
+    bool added = timer_wheel_add(current_thread, deadline_us);
+    thread_wait_end();
+    if (added) {
+        thread_block_with(sched);
+    } else {
+        thread_block_abort(sched);
+    }
+
+    InterruptManager::interrupt_set(enabled);
+}
+
+// Park the current thread on the wait queue of a registered fd until an edge for the given events, or until
+// deadline_us if it is not UINT64_MAX. Returns the events reported, 0 on timeout. edges is the fd's edge count taken
+// before the caller found the fd not ready: if an edge has been dispatched since, the thread does not park and the
+// given events are returned, for the caller to try again.
+template<class Sched>
+int thread_wait_fd_with(Sched &sched, int fd, short events, uint64_t deadline_us, unsigned edges) {
+    int enabled = InterruptManager::interrupt_off();
+
+    Thread *curr = current_thread;
+    if (!thread_wait_begin()) {
+        MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    }
+    int ret = 0;
+    if (deadline_us == UINT64_MAX || timer_wheel_add(curr, deadline_us)) {
+        if (event_loop_add(curr, fd, events, edges)) {
+            thread_wait_end();
+            thread_block_with(sched);
+            ret = curr->io_revents;
+            InterruptManager::interrupt_set(enabled);
+            return ret;
+        }
+        timer_wheel_cancel(curr);
+        ret = events;
+    }
+    thread_wait_end();
+    thread_block_abort(sched);
+
+    InterruptManager::interrupt_set(enabled);
+    return ret;
+}
+
+template<class Sched>
+int thread_wait_io_with(Sched &sched, int fd, short events) {
+    if ((events & (POLLIN | POLLOUT)) == 0 || (events & ~(POLLIN | POLLOUT)) != 0) {
+        return static_cast<int>(MicroFiber::ThreadCodes::INVALID);
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    int registered = event_loop_register(fd);
+    unsigned edges = event_loop_edges(fd);
+    struct pollfd p{fd, events, 0};
+    int ret;
+    if (registered < 0) {
+        ret = static_cast<int>(MicroFiber::ThreadCodes::INVALID);
+    } else if (registered == 0) {
+        ret = events;
+    } else if (poll(&p, 1, 0) > 0) {
+        ret = p.revents;
+    } else {
+        ret = thread_wait_fd_with(sched, fd, events, UINT64_MAX, edges);
+    }
+    InterruptManager::interrupt_set(enabled);
+    return ret;
+}
+
+template<class Sched>
+int thread_wakeup_with(Sched &sched, FifoQueue *queue, bool wake_all) {
+    if (queue == nullptr) {
+        return 0;
+    }
+
+    int enabled = InterruptManager::interrupt_off();
+    WordLock &lock = wait_lock(queue);
+    WokenList woken;
+    lock.lock();
+    while (Thread *thread = queue->pop()) {
+        // A thread claimed by a killer is only taken off the queue
+        if (thread_claim(thread)) {
+            woken.push(thread);
+            if (!wake_all) {
+                break;
+            }
+        }
+    }
+    lock.unlock();
+
+    int num_woken = 0;
+    while (Thread *thread = woken.pop()) {
+        thread_unwait(thread);
+        thread_ready(sched, thread);
+        if (sched.is_realtime()) {
+            thread_yield_with(sched, static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+        }
+        num_woken++;
+    }
+
+    InterruptManager::interrupt_set(enabled);
+    return num_woken;
+}
+
+#endif //MICROFIBER_THREAD_OPS_H
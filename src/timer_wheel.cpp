@@ -0,0 +1,264 @@
+#include "timer_wheel.hpp"
+#include "microfiber.hpp"
+#include "thread_manager.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+#include "worker.hpp"
+#include "word_lock.hpp"
+
+#include <cassert>
+#include <ctime>
+
+constexpr unsigned WHEEL_LEVELS = 4;
+constexpr unsigned WHEEL_BITS = 6;
+constexpr unsigned WHEEL_SLOTS = 1u << WHEEL_BITS;
+constexpr uint64_t WHEEL_MASK = WHEEL_SLOTS - 1;
+
+// Timers further out than this are parked in the top level and placed again when it is reached
+constexpr uint64_t WHEEL_SPAN = uint64_t(1) << (WHEEL_LEVELS * WHEEL_BITS);
+
+std::atomic<unsigned long> timer_count(0);
+std::atomic<uint64_t> timer_next_due_us(UINT64_MAX);
+
+// Guards the slots, now_tick and the timer members of the threads on the wheel
+static WordLock wheel_lock;
+
+// Heads of the slot lists, and per level a bitmap of the non-empty slots
+static Thread *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t occupied[WHEEL_LEVELS];
+
+// The last tick processed, every timer expiring at or before it has been run
+static uint64_t now_tick = 0;
+
+uint64_t timer_now_us() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+// Link thread into the slot its expiry tick falls in, relative to now_tick
+static void place(Thread *thread) {
+    uint64_t expires = thread->timer_expires > now_tick ? thread->timer_expires : now_tick;
+    uint64_t delta = expires - now_tick;
+    if (delta >= WHEEL_SPAN) {
+        expires = now_tick + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+
+    unsigned level = 0;
+    while (delta >= (uint64_t(1) << ((level + 1) * WHEEL_BITS))) {
+        level++;
+    }
+    unsigned index = static_cast<unsigned>((expires >> (level * WHEEL_BITS)) & WHEEL_MASK);
+
+    Thread **head = &slots[level][index];
+    thread->timer_next = *head;
+    if (*head != nullptr) {
+        (*head)->timer_pprev = &thread->timer_next;
+    }
+    thread->timer_pprev = head;
+    *head = thread;
+    thread->timer_slot = static_cast<uint16_t>(level * WHEEL_SLOTS + index);
+    occupied[level] |= uint64_t(1) << index;
+}
+
+// Unlink thread from its slot
+static void unlink(Thread *thread) {
+    *thread->timer_pprev = thread->timer_next;
+    if (thread->timer_next != nullptr) {
+        thread->timer_next->timer_pprev = thread->timer_pprev;
+    }
+
+    unsigned level = thread->timer_slot / WHEEL_SLOTS;
+    unsigned index = thread->timer_slot % WHEEL_SLOTS;
+    if (slots[level][index] == nullptr) {
+        occupied[level] &= ~(uint64_t(1) << index);
+    }
+    thread->timer_next = nullptr;
+    thread->timer_pprev = nullptr;
+}
+
+// Take every timer out of a slot, returning them as a list linked through timer_next
+static Thread *take_slot(unsigned level, unsigned index) {
+    Thread *list = slots[level][index];
+    slots[level][index] = nullptr;
+    occupied[level] &= ~(uint64_t(1) << index);
+    for (Thread *t = list; t != nullptr; t = t->timer_next) {
+        t->timer_pprev = nullptr;
+    }
+    return list;
+}
+
+// Move the timers of an upper-level slot down, now that the wheel has reached it
+static void cascade(unsigned level) {
+    unsigned index = static_cast<unsigned>((now_tick >> (level * WHEEL_BITS)) & WHEEL_MASK);
+    Thread *list = take_slot(level, index);
+    while (list != nullptr) {
+        Thread *t = list;
+        list = t->timer_next;
+        place(t);
+    }
+}
+
+// Claim a thread whose timer expired, appending it at tail to the fired list linked through timer_next. A thread that
+// something else claimed first is only dropped from the wheel.
+static void fire(Thread *thread, Thread **&tail) {
+    timer_count.fetch_sub(1, std::memory_order_relaxed);
+    if (thread_claim(thread)) {
+        *tail = thread;
+        tail = &thread->timer_next;
+    }
+}
+
+// Process every tick up to and including tick, appending the threads claimed at tail
+static void advance(uint64_t tick, Thread **&tail) {
+    while (now_tick < tick && timer_count != 0) {
+        // Nothing expires before level 0 wraps around and is refilled from level 1, so skip straight there
+        if (occupied[0] == 0) {
+            uint64_t wrap = (now_tick | WHEEL_MASK) + 1;
+            if (wrap > tick) {
+                break;
+            }
+            now_tick = wrap - 1;
+        }
+
+        now_tick++;
+
+        // Find the highest level whose slot was just reached, and cascade from there down so that timers moved
+        // into a lower level are moved down again in the same tick
+        unsigned top = 0;
+        while (top + 1 < WHEEL_LEVELS && (now_tick & ((uint64_t(1) << ((top + 1) * WHEEL_BITS)) - 1)) == 0) {
+            top++;
+        }
+        for (unsigned level = top; level >= 1; level--) {
+            cascade(level);
+        }
+
+        Thread *list = take_slot(0, static_cast<unsigned>(now_tick & WHEEL_MASK));
+        while (list != nullptr) {
+            Thread *t = list;
+            list = t->timer_next;
+            t->timer_next = nullptr;
+            if (t->timer_expires > now_tick) {
+                // Parked beyond the span of the wheel
+                place(t);
+            } else {
+                fire(t, tail);
+            }
+        }
+    }
+    if (now_tick < tick) {
+        now_tick = tick;
+    }
+}
+
+// The next tick at which advance has something to do: an expiry in level 0 or a cascade from an upper level, or
+// UINT64_MAX if the wheel is empty
+static uint64_t next_event() {
+    uint64_t next = UINT64_MAX;
+    for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+        if (occupied[level] == 0) {
+            continue;
+        }
+        unsigned shift = level * WHEEL_BITS;
+        uint64_t cur = now_tick >> shift;
+
+        // Rotate so that bit 0 is the slot reached next
+        unsigned rot = static_cast<unsigned>((cur + 1) & WHEEL_MASK);
+        uint64_t bits = (occupied[level] >> rot) | (rot ? occupied[level] << (WHEEL_SLOTS - rot) : 0);
+        uint64_t tick = (cur + __builtin_ctzll(bits) + 1) << shift;
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+// Publish when the wheel next has work to do, once it has changed
+static void update_next_due() {
+    uint64_t next = next_event();
+    timer_next_due_us.store(next == UINT64_MAX ? UINT64_MAX : next * TIMER_TICK_US, std::memory_order_relaxed);
+}
+
+void timer_wheel_init() {
+    for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+        for (unsigned index = 0; index < WHEEL_SLOTS; index++) {
+            slots[level][index] = nullptr;
+        }
+        occupied[level] = 0;
+    }
+    timer_count.store(0);
+    timer_next_due_us.store(UINT64_MAX);
+    now_tick = timer_now_us() / TIMER_TICK_US;
+}
+
+void timer_wheel_end() {
+    for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+        for (unsigned index = 0; index < WHEEL_SLOTS; index++) {
+            take_slot(level, index);
+        }
+    }
+    timer_count.store(0);
+    timer_next_due_us.store(UINT64_MAX);
+}
+
+bool timer_wheel_add(Thread *thread, uint64_t deadline_us) {
+    // Round up, a timer never fires early
+    uint64_t expires = (deadline_us + TIMER_TICK_US - 1) / TIMER_TICK_US;
+    wheel_lock.lock();
+    assert(thread->timer_pprev == nullptr);
+    if (timer_count.load(std::memory_order_relaxed) == 0) {
+        now_tick = timer_now_us() / TIMER_TICK_US;
+    }
+    if (expires <= now_tick) {
+        wheel_lock.unlock();
+        return false;
+    }
+
+    thread->timer_expires = expires;
+    place(thread);
+    timer_count.fetch_add(1, std::memory_order_relaxed);
+    update_next_due();
+    wheel_lock.unlock();
+
+    // Someone has to notice the expiry even if the thread that is running now never yields, and worker 0 may be
+    // waiting idle for a later one
+    InterruptManager::timer_arm();
+    worker_kick_io();
+    return true;
+}
+
+// Called with the thread's lock held, so no timer of it can be added meanwhile: the test without the wheel lock only
+// misses a timer that is being fired, which leaves nothing to cancel
+void timer_wheel_cancel(Thread *thread) {
+    if (__atomic_load_n(&thread->timer_pprev, __ATOMIC_RELAXED) == nullptr) {
+        return;
+    }
+    wheel_lock.lock();
+    if (thread->timer_pprev != nullptr) {
+        unlink(thread);
+        timer_count.fetch_sub(1, std::memory_order_relaxed);
+        update_next_due();
+    }
+    wheel_lock.unlock();
+}
+
+void timer_wheel_expire() {
+    uint64_t now = timer_now_us();
+    if (now < timer_next_due_us.load(std::memory_order_relaxed) || !wheel_lock.try_lock()) {
+        return;
+    }
+    Thread *fired = nullptr;
+    Thread **tail = &fired;
+    advance(now / TIMER_TICK_US, tail);
+    update_next_due();
+    wheel_lock.unlock();
+
+    while (fired != nullptr) {
+        Thread *thread = fired;
+        fired = thread->timer_next;
+        thread->timer_next = nullptr;
+        thread_unwait(thread);
+        thread_ready(*scheduler, thread);
+    }
+}
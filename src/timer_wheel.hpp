@@ -0,0 +1,59 @@
+#ifndef MICROFIBER_TIMER_WHEEL_H
+#define MICROFIBER_TIMER_WHEEL_H
+
+#include <atomic>
+#include <cstdint>
+
+class Thread;
+
+// Pending sleep timers live in a hierarchical timing wheel: four levels of 64 slots, each level counting ticks of
+// TIMER_TICK_US 64 times coarser than the one below. Adding and cancelling a timer is O(1); a timer in an upper level
+// is moved down when the wheel reaches its slot. Timers are linked through the Thread, so nothing is allocated.
+//
+// The wheel has a lock of its own. It is driven by whichever worker polls it once the next timer is due; the others
+// skip the expiry while one holds the lock rather than wait for it. A thread whose timer expires is claimed under the
+// lock and made ready once it is released.
+
+// Number of timers currently pending
+extern std::atomic<unsigned long> timer_count;
+
+// CLOCK_MONOTONIC time in microseconds at which the wheel next has work to do, UINT64_MAX if none
+extern std::atomic<uint64_t> timer_next_due_us;
+
+// Start the wheel at the current time
+void timer_wheel_init();
+
+// Drop every pending timer
+void timer_wheel_end();
+
+// Current CLOCK_MONOTONIC time in microseconds
+uint64_t timer_now_us();
+
+// Make thread ready again at deadline_us. Returns false, adding nothing, if the deadline has already passed.
+bool timer_wheel_add(Thread *thread, uint64_t deadline_us);
+
+// Cancel the pending timer of thread, if any
+void timer_wheel_cancel(Thread *thread);
+
+// Make the threads whose deadline has passed ready, unless another worker is already doing it
+void timer_wheel_expire();
+
+// CLOCK_MONOTONIC time in microseconds at which the wheel next has work to do, which may be a move between levels
+// rather than an expiry, or UINT64_MAX if no timer is pending. Lets an idle wait end in time for the earliest timer.
+inline uint64_t timer_wheel_next_us() {
+    return timer_next_due_us.load(std::memory_order_relaxed);
+}
+
+// Whether any thread is waiting on a timer
+inline bool timer_wheel_pending() {
+    return timer_count.load(std::memory_order_relaxed) != 0;
+}
+
+// Expire due timers, costing a single test when none are pending
+inline void timer_wheel_poll() {
+    if (timer_wheel_pending()) {
+        timer_wheel_expire();
+    }
+}
+
+#endif //MICROFIBER_TIMER_WHEEL_H
@@ -0,0 +1,139 @@
+#include "topology.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Nodes above this are ignored
+constexpr int MAX_NODES = 1024;
+
+static std::vector<CpuPlace> cpus;
+static int node_count = 1;
+static cpu_set_t allowed;
+
+// Whether a system thread was pinned, which threads it starts inherit
+static bool pinned = false;
+
+// Parse a sysfs list such as "0-3,8,10-11" and call fn on each number in it. Returns false if the file is missing.
+template<class Fn>
+static bool read_list(const char *path, Fn fn) {
+    FILE *f = fopen(path, "r");
+    if (f == nullptr) {
+        return false;
+    }
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
+
+    char *p = buf;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            fn(static_cast<int>(cpu));
+        }
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return true;
+}
+
+void topology_init() {
+    cpus.clear();
+    node_count = 1;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_SET(0, &allowed);
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(CpuPlace{cpu, 0, -1});
+        }
+    }
+
+    std::vector<int> nodes;
+    read_list("/sys/devices/system/node/online", [&nodes](int node) {
+        if (node < MAX_NODES) {
+            nodes.push_back(node);
+        }
+    });
+    char path[128];
+    for (int node: nodes) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        read_list(path, [node](int cpu) {
+            for (CpuPlace &place: cpus) {
+                if (place.cpu == cpu) {
+                    place.node = node;
+                }
+            }
+        });
+        if (node + 1 > node_count) {
+            node_count = node + 1;
+        }
+    }
+
+    for (CpuPlace &place: cpus) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/shared_cpu_list", place.cpu);
+        int lowest = -1;
+        read_list(path, [&lowest](int cpu) {
+            if (lowest < 0 || cpu < lowest) {
+                lowest = cpu;
+            }
+        });
+        place.cache = lowest;
+    }
+}
+
+const std::vector<CpuPlace> &topology_cpus() {
+    return cpus;
+}
+
+int topology_nodes() {
+    return node_count;
+}
+
+bool topology_pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+    pinned = true;
+    return true;
+}
+
+void topology_unpin() {
+    if (!pinned) {
+        return;
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(allowed), &allowed);
+}
+
+bool topology_bind(void *addr, size_t len, int node) {
+    if (node_count <= 1 || node < 0) {
+        return true;
+    }
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {};
+    mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+    return syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, MAX_NODES, 0) == 0;
+}
@@ -0,0 +1,36 @@
+#ifndef MICROFIBER_TOPOLOGY_H
+#define MICROFIBER_TOPOLOGY_H
+
+#include <cstddef>
+#include <vector>
+
+// Where the CPUs the process may run on sit, read from sysfs: the NUMA node each belongs to and the last-level cache
+// it shares with others. Used to pin workers, to keep the memory of a worker's threads on its node and to steal from
+// the nearest workers first. Without the sysfs entries every CPU is on node 0 and shares nothing.
+
+struct CpuPlace {
+    int cpu;
+    int node;
+    int cache;                  // lowest CPU sharing this CPU's last-level cache, -1 if unknown
+};
+
+// Read the topology and the CPUs the calling thread may run on, which later pinning does not change
+void topology_init();
+
+// The CPUs the process may run on, in increasing order
+const std::vector<CpuPlace> &topology_cpus();
+
+// Number of NUMA nodes, 1 on a machine that is not NUMA
+int topology_nodes();
+
+// Run the calling system thread on cpu only
+bool topology_pin(int cpu);
+
+// Let the calling system thread run on every CPU the process started with again, if a thread was pinned
+void topology_unpin();
+
+// Ask for the pages of [addr, addr + len), which must be page aligned and not touched yet, to be placed on node.
+// Does nothing on a machine that is not NUMA. Returns false if the kernel refused.
+bool topology_bind(void *addr, size_t len, int node);
+
+#endif //MICROFIBER_TOPOLOGY_H
@@ -0,0 +1,332 @@
+#include "uring.hpp"
+#include "microfiber.hpp"
+#include "thread_manager.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+#include "word_lock.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+std::atomic<unsigned long> uring_inflight(0);
+
+static int ring_fd = -1;
+
+// Guards both rings, the deferred cancels, the counters and the uring_pending flag of the threads
+static WordLock ring_lock;
+
+// Submission ring, shared with the kernel
+static unsigned *sq_head;
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static struct io_uring_sqe *sqes;
+static unsigned sq_entries;
+
+// Completion ring, shared with the kernel
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+
+static void *sq_ring;
+static size_t sq_ring_size;
+static void *cq_ring;
+static size_t cq_ring_size;
+static size_t sqes_size;
+
+// Our copy of the submission tail, and how many entries behind it the kernel has not been told about
+static unsigned sq_local_tail;
+static unsigned sq_queued;
+
+// Threads whose cancel found the submission ring full, queued once a submission makes room
+static std::vector<Thread *> deferred_cancels;
+
+static unsigned long submissions = 0;
+static unsigned long enters = 0;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+bool uring_init(unsigned entries) {
+    assert(ring_fd < 0);
+    struct io_uring_params params{};
+    params.flags = IORING_SETUP_CLAMP;
+
+    int fd = io_uring_setup(entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_ring_size = cq_ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            munmap(sq_ring, sq_ring_size);
+            close(fd);
+            return false;
+        }
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) {
+        if (cq_ring != sq_ring) {
+            munmap(cq_ring, cq_ring_size);
+        }
+        munmap(sq_ring, sq_ring_size);
+        close(fd);
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe *>(s);
+
+    auto *sq = static_cast<char *>(sq_ring);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sq_entries = params.sq_entries;
+
+    auto *cq = static_cast<char *>(cq_ring);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    sq_local_tail = *sq_tail;
+    sq_queued = 0;
+    uring_inflight.store(0);
+    submissions = 0;
+    enters = 0;
+    ring_fd = fd;
+    return true;
+}
+
+void uring_end() {
+    if (ring_fd < 0) {
+        return;
+    }
+    munmap(sqes, sqes_size);
+    if (cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    munmap(sq_ring, sq_ring_size);
+    close(ring_fd);
+    ring_fd = -1;
+    uring_inflight.store(0);
+    deferred_cancels.clear();
+}
+
+bool uring_enabled() {
+    return ring_fd >= 0;
+}
+
+int uring_fd() {
+    return ring_fd;
+}
+
+void uring_lock() {
+    ring_lock.lock();
+}
+
+void uring_unlock() {
+    ring_lock.unlock();
+}
+
+bool uring_has_queued() {
+    ring_lock.lock();
+    bool queued = sq_queued != 0 || !deferred_cancels.empty();
+    ring_lock.unlock();
+    return queued;
+}
+
+static bool sq_full() {
+    return sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries;
+}
+
+static void submit_queued() {
+    while (sq_queued != 0) {
+        // Publish the entries before the kernel reads the tail
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        int ret = io_uring_enter(ring_fd, sq_queued, 0, 0);
+        enters++;
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Out of resources for now (EAGAIN, EBUSY); the entries stay queued and go with the next submission
+            return;
+        }
+        sq_queued -= static_cast<unsigned>(ret);
+        if (ret == 0) {
+            return;
+        }
+    }
+}
+
+static void queue_cancel(Thread *thread) {
+    unsigned index = sq_local_tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(thread);
+
+    // The cancel request completes too, with no thread to resume
+    sqe->user_data = 0;
+    sq_array[index] = index;
+    sq_local_tail++;
+    sq_queued++;
+}
+
+// Submit the queued entries, then the deferred cancels that now fit, with the ring lock held
+static void submit_locked() {
+    submit_queued();
+    if (deferred_cancels.empty()) {
+        return;
+    }
+    while (!deferred_cancels.empty() && !sq_full()) {
+        queue_cancel(deferred_cancels.back());
+        deferred_cancels.pop_back();
+    }
+    submit_queued();
+}
+
+void uring_submit() {
+    ring_lock.lock();
+    submit_locked();
+    ring_lock.unlock();
+}
+
+struct io_uring_sqe *uring_get_sqe() {
+    if (sq_full()) {
+        submit_locked();
+        if (sq_full()) {
+            return nullptr;
+        }
+    }
+    unsigned index = sq_local_tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void uring_queue(struct io_uring_sqe *sqe, Thread *thread) {
+    unsigned index = static_cast<unsigned>(sqe - sqes);
+    sqe->user_data = reinterpret_cast<uint64_t>(thread);
+    sq_array[sq_local_tail & *sq_mask] = index;
+    sq_local_tail++;
+    sq_queued++;
+    submissions++;
+    uring_inflight.fetch_add(1, std::memory_order_relaxed);
+    thread->uring_pending = true;
+}
+
+// Once the operation is reaped the thread may run, exit and be reused, so the cancel is only queued while the
+// operation is still pending
+void uring_cancel(Thread *thread) {
+    ring_lock.lock();
+    if (!thread->uring_pending || thread->state.load() != Thread::State::KILLED) {
+        ring_lock.unlock();
+        return;
+    }
+    if (sq_full()) {
+        submit_locked();
+        if (sq_full()) {
+            // Dropping the cancel would leave a killed thread waiting on an operation that may never complete
+            deferred_cancels.push_back(thread);
+            ring_lock.unlock();
+            return;
+        }
+    }
+    queue_cancel(thread);
+    submit_locked();
+    ring_lock.unlock();
+}
+
+static void drop_deferred_cancel(Thread *thread) {
+    for (size_t i = 0; i < deferred_cancels.size(); i++) {
+        if (deferred_cancels[i] == thread) {
+            deferred_cancels[i] = deferred_cancels.back();
+            deferred_cancels.pop_back();
+            return;
+        }
+    }
+}
+
+// The completed threads are collected through next, as a thread waiting for an operation is in no queue, and made
+// ready once the lock is released
+unsigned uring_reap() {
+    if (__atomic_load_n(cq_head, __ATOMIC_RELAXED) == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    Thread *done = nullptr;
+    Thread **tail_next = &done;
+    ring_lock.lock();
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        auto *thread = reinterpret_cast<Thread *>(cqe->user_data);
+        if (thread != nullptr) {
+            thread->io_result = cqe->res;
+            thread->uring_pending = false;
+            uring_inflight.fetch_sub(1, std::memory_order_relaxed);
+            // An operation that completed before its cancel was queued needs none
+            if (!deferred_cancels.empty()) {
+                drop_deferred_cancel(thread);
+            }
+            thread->next = nullptr;
+            *tail_next = thread;
+            tail_next = &thread->next;
+        }
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    ring_lock.unlock();
+
+    unsigned woken = 0;
+    while (done != nullptr) {
+        Thread *thread = done;
+        done = thread->next;
+        thread->next = nullptr;
+        // A killed thread is made ready all the same, to exit now that the kernel is done with its buffers
+        thread_claim(thread, Thread::State::IO_BLOCKED);
+        thread_ready(*scheduler, thread);
+        woken++;
+    }
+    return woken;
+}
+
+UringStats MicroFiber::get_uring_stats() {
+    UringStats ret{};
+    ret.enabled = uring_enabled();
+    ring_lock.lock();
+    ret.submissions = submissions;
+    ret.enters = enters;
+    ring_lock.unlock();
+    return ret;
+}
@@ -0,0 +1,61 @@
+#ifndef MICROFIBER_URING_H
+#define MICROFIBER_URING_H
+
+#include <atomic>
+#include <cstdint>
+
+class Thread;
+struct io_uring_sqe;
+
+// Completion-based I/O through io_uring, used directly through its system calls. A thread fills a submission queue
+// entry and parks; the entries of every thread that blocks before the scheduler next runs out of ready threads are
+// handed to the kernel by a single io_uring_enter. Completions are read from the shared completion ring without a
+// system call, and the ring fd is watched by the event loop so the idle wait also ends when one arrives.
+//
+// The ring is shared by every worker and guarded by a lock of its own, which a thread holds from taking an entry until
+// it has queued it. Submitting, reaping and cancelling take it themselves.
+
+// Number of operations submitted to the kernel and not completed yet, or queued for submission
+extern std::atomic<unsigned long> uring_inflight;
+
+// Try to set up a ring of the given number of entries. Returns false, leaving io_uring disabled, if the kernel does
+// not support it or does not allow it.
+bool uring_init(unsigned entries);
+
+// Tear the ring down
+void uring_end();
+
+// Whether uring_init succeeded
+bool uring_enabled();
+
+// The ring fd, for the event loop to watch, or -1
+int uring_fd();
+
+// Take and release the ring lock, around uring_get_sqe and uring_queue
+void uring_lock();
+
+void uring_unlock();
+
+// A free submission entry, zeroed, submitting the queued ones first if the ring is full. Called with the ring lock
+// held.
+struct io_uring_sqe *uring_get_sqe();
+
+// Queue a filled-in entry on behalf of thread, which is then made ready with the result in io_result. Called with the
+// ring lock held; the caller kicks worker 0 once it has released it, as the event loop submits.
+void uring_queue(struct io_uring_sqe *sqe, Thread *thread);
+
+// Ask the kernel to cancel the operation thread waits for, if thread was killed while it waits for one; it still
+// completes, with -ECANCELED if the cancel won. A cancel that finds the ring full even after a submission is kept and
+// queued by the next submission that makes room.
+void uring_cancel(Thread *thread);
+
+// Hand the queued entries to the kernel
+void uring_submit();
+
+// Make the threads whose operation completed ready, returns how many
+unsigned uring_reap();
+
+// Whether entries or cancels are queued but not submitted yet
+bool uring_has_queued();
+
+#endif //MICROFIBER_URING_H
@@ -0,0 +1,198 @@
+#include "wake.hpp"
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "thread_manager.hpp"
+#include "event_loop.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+std::atomic<unsigned long> wake_waiting(0);
+std::atomic<WakeHandle *> wake_fired(nullptr);
+
+// Guards the waiter of every handle, and is held by a reap from taking the stack until it is done with its handles
+static WordLock wake_lock;
+
+// Signals the runtime when the fired stack turns non-empty
+static int kick_fd = -1;
+
+void wake_init() {
+    kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (kick_fd < 0) {
+        perror("Creating wake eventfd");
+        assert(0);
+    }
+    event_loop_watch(kick_fd);
+    wake_waiting.store(0);
+}
+
+void wake_end() {
+    // Handles that outlive the runtime must not think they are still queued
+    WakeHandle *list = wake_fired.exchange(nullptr, std::memory_order_acquire);
+    while (list != nullptr) {
+        WakeHandle *next = list->next;
+        list->queued.store(false);
+        list = next;
+    }
+    if (kick_fd >= 0) {
+        close(kick_fd);
+        kick_fd = -1;
+    }
+    wake_waiting.store(0);
+}
+
+unsigned wake_reap() {
+    WokenList woken;
+    wake_lock.lock();
+
+    // Drain the eventfd before taking the stack: a handle pushed after the exchange kicks again
+    uint64_t count;
+    ssize_t ret = read(kick_fd, &count, sizeof(count));
+    (void) ret;
+
+    WakeHandle *list = wake_fired.exchange(nullptr, std::memory_order_acquire);
+    while (list != nullptr) {
+        WakeHandle *handle = list;
+        list = handle->next;
+
+        // Cleared before the flag is looked at, so that a fire from now on queues the handle again. Both are
+        // sequentially consistent, as fire sets them in the opposite order.
+        handle->queued.store(false);
+        Thread *thread = handle->waiter;
+        // A waiter claimed by a killer is left for its thread_unwait to withdraw
+        if (thread == nullptr || !handle->fired.load() || !thread_claim(thread)) {
+            continue;
+        }
+        handle->waiter = nullptr;
+        thread->wake_wait = nullptr;
+        wake_waiting.fetch_sub(1, std::memory_order_relaxed);
+        woken.push(thread);
+    }
+    wake_lock.unlock();
+    return woken.ready(*scheduler);
+}
+
+// Called with the thread's lock held, so the thread cannot start a wait meanwhile
+void wake_cancel(Thread *thread) {
+    if (__atomic_load_n(&thread->wake_wait, __ATOMIC_RELAXED) == nullptr) {
+        return;
+    }
+    wake_lock.lock();
+    WakeHandle *handle = thread->wake_wait;
+    if (handle != nullptr) {
+        handle->waiter = nullptr;
+        thread->wake_wait = nullptr;
+        wake_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+    wake_lock.unlock();
+}
+
+WakeHandle::WakeHandle() : fired(false), queued(false), firing(0), waiter(nullptr), next(nullptr) {}
+
+WakeHandle::~WakeHandle() {
+    assert(waiter == nullptr);
+
+    // A wait may return as soon as a fire has set the flag, while that fire has yet to push the handle. The firing
+    // thread runs on its own, so give it the CPU until it is done.
+    while (firing.load(std::memory_order_acquire) != 0) {
+        sched_yield();
+    }
+    if (current_thread == nullptr) {
+        // The runtime has ended, and wake_end took the handle off the stack
+        assert(!queued.load());
+        return;
+    }
+
+    // A reap holds the lock until it is done with the handles it took, so once it is taken no worker still touches
+    // this one, and a handle still marked queued is on the stack, which must not point at it once it is gone
+    int enabled = InterruptManager::interrupt_off();
+    wake_lock.lock();
+    bool on_stack = queued.load();
+    wake_lock.unlock();
+    if (on_stack) {
+        wake_reap();
+    }
+    InterruptManager::interrupt_set(enabled);
+}
+
+int WakeHandle::wait() {
+    int enabled = InterruptManager::interrupt_off();
+
+    wake_lock.lock();
+    bool taken = waiter != nullptr;
+    wake_lock.unlock();
+    if (taken) {
+        InterruptManager::interrupt_set(enabled);
+        return static_cast<int>(MicroFiber::ThreadCodes::INVALID);
+    }
+
+    // A fire that comes before the thread is parked leaves the flag set, so the wakeup is not lost
+    while (!fired.exchange(false)) {
+        Thread *curr = current_thread;
+        if (!thread_wait_begin()) {
+            MicroFiber::thread_exit(static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+        }
+        wake_lock.lock();
+        if (waiter != nullptr) {
+            wake_lock.unlock();
+            thread_wait_end();
+            thread_block_abort(*scheduler);
+            InterruptManager::interrupt_set(enabled);
+            return static_cast<int>(MicroFiber::ThreadCodes::INVALID);
+        }
+        waiter = curr;
+        curr->wake_wait = this;
+        wake_waiting.fetch_add(1, std::memory_order_relaxed);
+
+        // A fire since the exchange may have been reaped already, and found no waiter to wake
+        if (fired.load()) {
+            waiter = nullptr;
+            curr->wake_wait = nullptr;
+            wake_waiting.fetch_sub(1, std::memory_order_relaxed);
+            wake_lock.unlock();
+            thread_wait_end();
+            thread_block_abort(*scheduler);
+            continue;
+        }
+        wake_lock.unlock();
+        thread_wait_end();
+        thread_block_with(*scheduler);
+    }
+
+    InterruptManager::interrupt_set(enabled);
+    return 0;
+}
+
+void WakeHandle::fire() {
+    // Counted before the flag is set, so that the destructor of a handle whose wait returned on this fire waits for
+    // the fire to be done with the handle
+    firing.fetch_add(1);
+    fired.store(true);
+    if (queued.exchange(true)) {
+        // Already on the stack, the runtime sees the flag when it takes it
+        firing.fetch_sub(1, std::memory_order_release);
+        return;
+    }
+
+    WakeHandle *head = wake_fired.load(std::memory_order_relaxed);
+    do {
+        next = head;
+    } while (!wake_fired.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+
+    // Only the push onto an empty stack needs a kick. A signal handler must leave errno as it found it.
+    if (head == nullptr) {
+        int saved_errno = errno;
+        uint64_t one = 1;
+        ssize_t ret = write(kick_fd, &one, sizeof(one));
+        (void) ret;
+        errno = saved_errno;
+    }
+    firing.fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,38 @@
+#ifndef MICROFIBER_WAKE_H
+#define MICROFIBER_WAKE_H
+
+#include <atomic>
+#include "microfiber.hpp"
+
+class Thread;
+
+// Wake handles carry wakeups into the runtime from outside it. fire() sets the handle's flag and, unless the handle is
+// already queued, pushes it on a lock-free stack and, if that stack was empty, writes an eventfd the event loop
+// watches. The runtime takes the whole stack and makes the thread waiting on each fired handle ready. The firing side
+// takes no lock, allocates nothing and touches no runtime state, so it is safe from any system thread and from a
+// signal handler. On the runtime side, the waiter of a handle is guarded by a lock of the wake handles.
+
+// Number of threads waiting on a wake handle
+extern std::atomic<unsigned long> wake_waiting;
+
+// Handles fired since the runtime last looked, most recent first
+extern std::atomic<WakeHandle *> wake_fired;
+
+// Create the eventfd and add it to the event loop
+void wake_init();
+
+// Close the eventfd and forget the handles still queued
+void wake_end();
+
+// Make the threads waiting on the fired handles ready, returns how many
+unsigned wake_reap();
+
+// Withdraw the wait of thread on a wake handle, if any, called by thread_unwait
+void wake_cancel(Thread *thread);
+
+// Whether fired handles wait for wake_reap, checked without a system call
+inline bool wake_has_fired() {
+    return wake_fired.load(std::memory_order_relaxed) != nullptr;
+}
+
+#endif //MICROFIBER_WAKE_H
@@ -0,0 +1,36 @@
+#include "word_lock.hpp"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Attempts at a held lock before sleeping on it
+constexpr int LOCK_SPINS = 100;
+
+static long futex(std::atomic<int> *word, int op, int val) {
+    return syscall(SYS_futex, reinterpret_cast<int *>(word), op, val, nullptr, nullptr, 0);
+}
+
+void WordLock::lock_slow() {
+    int c = 0;
+    for (int i = 0; i < LOCK_SPINS; i++) {
+        c = word.load(std::memory_order_relaxed);
+        if (c == 0 && word.compare_exchange_weak(c, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return;
+        }
+        __builtin_ia32_pause();
+    }
+
+    // Mark the lock contended so that the holder wakes us
+    if (c != 2) {
+        c = word.exchange(2, std::memory_order_acquire);
+    }
+    while (c != 0) {
+        futex(&word, FUTEX_WAIT_PRIVATE, 2);
+        c = word.exchange(2, std::memory_order_acquire);
+    }
+}
+
+void WordLock::wake() {
+    futex(&word, FUTEX_WAKE_PRIVATE, 1);
+}
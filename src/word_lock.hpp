@@ -0,0 +1,45 @@
+#ifndef MICROFIBER_WORD_LOCK_H
+#define MICROFIBER_WORD_LOCK_H
+
+#include <atomic>
+
+// A lock over one of the runtime's shared structures: the thread table, a wait queue, the timing wheel, the ring. Taken
+// by a worker with preemption disabled on it, held for a few instructions and never across a context switch, so a
+// fiber never waits for it. It spins a little before sleeping on a futex, for a holder the kernel has descheduled.
+class WordLock {
+public:
+    constexpr WordLock() : word(0) {}
+
+    WordLock(const WordLock &) = delete;
+
+    WordLock &operator=(const WordLock &) = delete;
+
+    void lock() {
+        int expected = 0;
+        if (!word.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            lock_slow();
+        }
+    }
+
+    // Take the lock only if it is free, for work that another worker is already doing when it is not
+    bool try_lock() {
+        int expected = 0;
+        return word.load(std::memory_order_relaxed) == 0 &&
+               word.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        if (word.exchange(0, std::memory_order_release) == 2) {
+            wake();
+        }
+    }
+
+private:
+    void lock_slow();
+
+    void wake();
+
+    std::atomic<int> word;      // 0 if free, 1 if held, 2 if held and another worker may sleep on it
+};
+
+#endif //MICROFIBER_WORD_LOCK_H
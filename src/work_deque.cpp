@@ -0,0 +1,149 @@
+#include "work_deque.hpp"
+
+// Initial number of slots, a power of two
+constexpr int64_t WORK_DEQUE_CAPACITY = 64;
+
+struct WorkDeque::Array {
+    explicit Array(int64_t capacity)
+            : mask(capacity - 1), slots(new std::atomic<Thread *>[capacity]), marks(new std::atomic<uint32_t>[capacity]) {}
+
+    ~Array() {
+        delete[] slots;
+        delete[] marks;
+    }
+
+    [[nodiscard]] int64_t capacity() const {
+        return mask + 1;
+    }
+
+    [[nodiscard]] Thread *get(int64_t i) const {
+        return slots[i & mask].load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint32_t mark(int64_t i) const {
+        return marks[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, Thread *node, uint32_t mark) {
+        slots[i & mask].store(node, std::memory_order_relaxed);
+        marks[i & mask].store(mark, std::memory_order_relaxed);
+    }
+
+    int64_t mask;
+    std::atomic<Thread *> *slots;
+    std::atomic<uint32_t> *marks;   // the node's deque_mark when it was pushed into the slot
+};
+
+// Take the node pushed with the given mark, unless it was taken through another slot or by remove
+static bool claim(Thread *node, uint32_t mark) {
+    return node->deque_mark.compare_exchange_strong(mark, mark + 1, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed);
+}
+
+WorkDeque::WorkDeque() : top(0), bottom(0), array(new Array(WORK_DEQUE_CAPACITY)) {}
+
+WorkDeque::~WorkDeque() {
+    clear();
+    delete array.load(std::memory_order_relaxed);
+}
+
+WorkDeque::Array *WorkDeque::grow(Array *old, int64_t t, int64_t b) {
+    auto *a = new Array(old->capacity() * 2);
+    for (int64_t i = t; i < b; i++) {
+        a->put(i, old->get(i), old->mark(i));
+    }
+    retired.push_back(old);
+    array.store(a, std::memory_order_release);
+    return a;
+}
+
+void WorkDeque::push(Thread *node) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Array *a = array.load(std::memory_order_relaxed);
+    if (b - t > a->mask) {
+        a = grow(a, t, b);
+    }
+    // The next odd mark: a slot left behind by an earlier push of the node never matches it again
+    uint32_t mark = (node->deque_mark.load(std::memory_order_relaxed) + 1) | 1;
+    node->deque_mark.store(mark, std::memory_order_relaxed);
+    a->put(b, node, mark);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Thread *WorkDeque::pop() {
+    while (true) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array *a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Thread *node = a->get(b);
+        uint32_t mark = a->mark(b);
+        if (t == b) {
+            // The last node: a thief may be taking it as well, and whoever moves top first wins
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+                return nullptr;
+            }
+        }
+        if (claim(node, mark)) {
+            return node;
+        }
+        // Removed already: the slot was only a tombstone
+    }
+}
+
+Thread *WorkDeque::steal() {
+    while (true) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Array *a = array.load(std::memory_order_acquire);
+        Thread *node = a->get(t);
+        uint32_t mark = a->mark(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        if (claim(node, mark)) {
+            return node;
+        }
+    }
+}
+
+Thread *WorkDeque::remove(Thread *node) {
+    // The node stays in its slot as a tombstone, which pop and steal skip when they reach it
+    uint32_t mark = node->deque_mark.load(std::memory_order_relaxed);
+    if ((mark & 1) == 0 || !claim(node, mark)) {
+        return nullptr;
+    }
+    return node;
+}
+
+unsigned WorkDeque::count() const {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<unsigned>(b - t) : 0;
+}
+
+void WorkDeque::clear() {
+    // Take what is left, so that no node keeps an odd mark once out of the deque
+    while (pop() != nullptr) {
+    }
+    top.store(0, std::memory_order_relaxed);
+    bottom.store(0, std::memory_order_relaxed);
+    for (Array *a: retired) {
+        delete a;
+    }
+    retired.clear();
+}
@@ -0,0 +1,60 @@
+#ifndef MICROFIBER_WORK_DEQUE_H
+#define MICROFIBER_WORK_DEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "thread_manager.hpp"
+
+// A Chase-Lev work-stealing deque of threads, with the memory orderings of Lê et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models". The owning worker pushes and pops at the bottom, other workers steal from the
+// top, and the deque itself takes no lock; only a steal racing with another steal or with a pop of the last thread
+// pays for a compare-and-swap. The array doubles when full. A replaced array is retired rather than freed, as a thief
+// may still be reading from it.
+//
+// A node can also be taken out of the middle by its owner. Each push gives the node a new odd Thread::deque_mark and
+// records it with the slot; pop, steal and remove all take the node by moving that mark to the next even value, so a
+// node is taken once whichever gets there first. A removed node leaves its slot behind as a tombstone, which pop and
+// steal skip when they reach it, and a slot from an earlier push never matches a later mark.
+class WorkDeque {
+public:
+    WorkDeque();
+
+    ~WorkDeque();
+
+    WorkDeque(const WorkDeque &) = delete;
+
+    WorkDeque &operator=(const WorkDeque &) = delete;
+
+    // Owner only: insert the node at the bottom
+    void push(Thread *node);
+
+    // Owner only: returns the node pushed last and removes it, or NULL if the deque is empty
+    Thread *pop();
+
+    // Returns the node pushed first and removes it, or NULL if the deque is empty or another worker took it first
+    Thread *steal();
+
+    // Owner only: takes the node out of the deque in O(1) and returns it, or NULL if it is not in the deque or another
+    // worker took it first. The node must not be in a deque of another owner.
+    Thread *remove(Thread *node);
+
+    // Returns the number of slots, removed nodes included until pop or steal reaches them
+    [[nodiscard]] unsigned count() const;
+
+    // Owner only, and only while nothing is stolen: empty the deque and free the retired arrays
+    void clear();
+
+private:
+    struct Array;
+
+    Array *grow(Array *old, int64_t top, int64_t bottom);
+
+    // The ends are written by different workers, so each gets its own cache line
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> top;
+    alignas(CACHE_LINE_SIZE) std::atomic<int64_t> bottom;
+    std::atomic<Array *> array;
+    std::vector<Array *> retired;
+};
+
+#endif //MICROFIBER_WORK_DEQUE_H
@@ -0,0 +1,467 @@
+#include "worker.hpp"
+#include "microfiber.hpp"
+#include "interrupt_manager.hpp"
+#include "thread_manager.hpp"
+#include "stack_pool.hpp"
+#include "timer_wheel.hpp"
+#include "event_loop.hpp"
+#include "schedulers/scheduler.hpp"
+#include "thread_ops.hpp"
+#include "topology.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+Worker *workers = nullptr;
+thread_local Worker *this_worker = nullptr;
+unsigned worker_count = 1;
+bool work_stealing = false;
+
+// The system threads of workers 1 and up
+static std::vector<std::thread> threads;
+
+static bool preemptive = false;
+static bool pin_workers = false;
+
+// Set on the way out
+static std::atomic<bool> stopping(false);
+
+// Workers other than 0 that are not sleeping idle. Worker 0 ends the process only once there are none, as any of them
+// may still make a thread ready. A waker pushes to an inbox before it can park, so a thread on its way to an inbox
+// keeps either its waker or its owner counted.
+static std::atomic<unsigned> busy_workers(0);
+
+// Workers sleeping idle, worker 0 included
+static std::atomic<unsigned> parked_workers(0);
+
+// Counts the threads placed, the next one goes on the worker this is at modulo the worker count
+static std::atomic<unsigned> next_worker(0);
+
+// Stack of the idle fiber of worker 0; the others idle on their system thread's own stack
+static void *idle_stack = nullptr;
+static size_t idle_stack_size = 0;
+
+// Mark the calling worker parked. A waker that pushed to the inbox after the worker last drained it, or a thread
+// pushed to a deque after the worker last swept them, may have found it not parked yet and left it unkicked, so the
+// worker kicks itself then and its wait returns right away. Its wakers look at the flag after they push, and it looks
+// at what they push after it sets the flag, so one of the two sees the other.
+static void worker_mark_parked(Worker *w) {
+    w->parked.store(true);
+    parked_workers.fetch_add(1);
+    if (w->inbox.load() != nullptr || (work_stealing && worker_stealable())) {
+        worker_kick(w);
+    }
+}
+
+// Run the threads of the worker's queue for as long as there are any, then sleep until there are more
+static void worker_idle(Worker *w) {
+    while (!stopping.load(std::memory_order_relaxed)) {
+        Thread *next = thread_next(*scheduler, false);
+        if (next != nullptr) {
+            thread_switch(next);
+            continue;
+        }
+        if (work_stealing) {
+            next = worker_steal();
+            if (next != nullptr) {
+                thread_switch(next);
+                continue;
+            }
+        }
+
+        if (w->id == 0) {
+            // Every other worker has parked, and had pushed what it made ready before it did, so the inbox is looked
+            // at again once they are seen parked
+            if (busy_workers.load() == 0 && !timer_wheel_pending() && !event_loop_pending() &&
+                w->inbox.load() == nullptr) {
+                // Nothing is left to run anywhere, nor will anything become ready
+                runtime_exit(last_exit_code);
+            }
+            event_loop_wait(true);
+            continue;
+        }
+
+        InterruptManager::timer_disarm();
+        worker_mark_parked(w);
+        if (busy_workers.fetch_sub(1) == 1) {
+            worker_kick(&workers[0]);
+        }
+        uint64_t count;
+        while (read(w->kick_fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+[[noreturn]] static void idle_entry(void *arg, void *) {
+    worker_idle(static_cast<Worker *>(arg));
+    assert(false);
+    __builtin_unreachable();
+}
+
+// How far worker b is from worker a: 0 if they share a last-level cache, 1 if they share a NUMA node, 2 otherwise
+static int worker_distance(const Worker *a, const Worker *b) {
+    if (a->cache >= 0 && a->cache == b->cache) {
+        return 0;
+    }
+    return a->node == b->node ? 1 : 2;
+}
+
+// Order the other workers nearest first. Workers at the same distance follow the worker round the ring, so that the
+// thieves of a group do not all go for the same victim first.
+static void worker_order_victims(Worker *w) {
+    w->victims.clear();
+    for (unsigned k = 1; k < worker_count; k++) {
+        w->victims.push_back((w->id + k) % worker_count);
+    }
+    std::stable_sort(w->victims.begin(), w->victims.end(), [w](unsigned a, unsigned b) {
+        return worker_distance(w, &workers[a]) < worker_distance(w, &workers[b]);
+    });
+}
+
+static void worker_main(Worker *w) {
+    this_worker = w;
+    scheduler = w->sched;
+    current_thread = &w->idle;
+    if (pin_workers) {
+        topology_pin(w->cpu);
+    }
+
+    // Preemption starts disabled on a new system thread
+    if (preemptive) {
+        InterruptManager::worker_timer_init();
+    }
+    worker_idle(w);
+    if (preemptive) {
+        InterruptManager::worker_timer_end();
+    }
+    stack_pool_flush();
+}
+
+void worker_init(const Config *config) {
+    assert(workers == nullptr);
+    worker_count = config->workers > 1 ? config->workers : 1;
+    workers = new Worker[worker_count]();
+    preemptive = config->is_preemptive;
+    pin_workers = config->pin_workers;
+    work_stealing = multi_worker() && config->scheduler_name == Config::SchedulerType::WorkStealing;
+    stopping.store(false);
+    parked_workers.store(0);
+    next_worker.store(0);
+    busy_workers.store(worker_count - 1);
+    if (pin_workers) {
+        topology_init();
+    }
+
+    for (unsigned i = 0; i < worker_count; i++) {
+        Worker *w = &workers[i];
+        w->id = i;
+        w->kick_fd = -1;
+        w->parked.store(false);
+        w->has_timer.store(false);
+        w->timer_armed.store(false);
+        w->steals = 0;
+        w->steal_failures = 0;
+        w->steals_same_cache = 0;
+        w->steals_remote_node = 0;
+        w->remote_stacks = 0;
+        w->cpu = -1;
+        w->node = 0;
+        w->cache = -1;
+        if (pin_workers) {
+            const std::vector<CpuPlace> &cpus = topology_cpus();
+            const CpuPlace &place = cpus[i % cpus.size()];
+            w->cpu = place.cpu;
+            w->node = place.node;
+            w->cache = place.cache;
+        }
+        w->inbox.store(nullptr, std::memory_order_relaxed);
+        w->incoming.store(0, std::memory_order_relaxed);
+        w->idle.id = -1;
+        w->idle.state = Thread::State::RUNNING;
+        w->idle.started = true;
+        w->idle.worker = w;
+        w->idle.io_fd = -1;
+    }
+    this_worker = &workers[0];
+    workers[0].sched = scheduler;
+    if (pin_workers) {
+        topology_pin(workers[0].cpu);
+    }
+    if (!multi_worker()) {
+        return;
+    }
+    if (work_stealing) {
+        for (unsigned i = 0; i < worker_count; i++) {
+            worker_order_victims(&workers[i]);
+        }
+    }
+
+    for (unsigned i = 0; i < worker_count; i++) {
+        Worker *w = &workers[i];
+        if (i > 0) {
+            w->sched = scheduler_create(config);
+            assert(w->sched != nullptr);
+        }
+        // Worker 0 waits in epoll, the others in read
+        w->kick_fd = eventfd(0, EFD_CLOEXEC | (i == 0 ? EFD_NONBLOCK : 0));
+        if (w->kick_fd < 0) {
+            perror("Creating worker eventfd");
+            assert(0);
+        }
+    }
+
+    idle_stack_size = stack_pool_round(MIN_STACK_SIZE);
+    idle_stack = stack_pool_alloc(idle_stack_size, workers[0].node);
+    assert(idle_stack != nullptr);
+    context_make(&workers[0].idle.context, idle_stack, idle_stack_size, idle_entry, &workers[0], nullptr);
+}
+
+void worker_start() {
+    if (!multi_worker()) {
+        return;
+    }
+    event_loop_watch(workers[0].kick_fd);
+    try {
+        for (unsigned i = 1; i < worker_count; i++) {
+            threads.emplace_back(worker_main, &workers[i]);
+        }
+    } catch (const std::system_error &e) {
+        fprintf(stderr, "Starting workers: %s\n", e.what());
+        assert(0);
+    }
+}
+
+void worker_end() {
+    if (multi_worker()) {
+        stopping.store(true);
+        for (unsigned i = 1; i < worker_count; i++) {
+            worker_kick(&workers[i]);
+        }
+        for (auto &t: threads) {
+            t.join();
+        }
+        threads.clear();
+
+        for (unsigned i = 0; i < worker_count; i++) {
+            if (i > 0) {
+                workers[i].sched->destroy();
+                delete workers[i].sched;
+            }
+            close(workers[i].kick_fd);
+        }
+        stack_pool_free(idle_stack, idle_stack_size, workers[0].node);
+        idle_stack = nullptr;
+    }
+
+    delete[] workers;
+    workers = nullptr;
+    this_worker = nullptr;
+    worker_count = 1;
+}
+
+Worker *worker_place() {
+    // Work stealing spreads the threads itself, and the creator is the most likely to run them with a warm cache
+    if (work_stealing) {
+        return this_worker;
+    }
+    return &workers[next_worker.fetch_add(1, std::memory_order_relaxed) % worker_count];
+}
+
+// Reverse a list linked through next, newest first, into the order it was built in
+static Thread *thread_list_reverse(Thread *list) {
+    Thread *ordered = nullptr;
+    while (list != nullptr) {
+        Thread *next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    return ordered;
+}
+
+// The thread is ready but on no queue until it reaches the inbox, which nothing that runs before then minds: only a
+// blocked thread is looked for in a queue, and a ready one is not stolen as it is in no deque.
+void worker_ready_remote(Thread *thread) {
+    assert(!FifoQueue::node_in_queue(thread));
+    Worker *w = thread->worker;
+    w->incoming.fetch_add(1);
+
+    // The owner may be running a thread that never yields, the tick makes it look at its inbox. Counting the thread in
+    // incoming before arming keeps the timer from being left stopped by a disarm racing with the arm.
+    InterruptManager::timer_arm(w);
+
+    // Sequentially consistent, against the parked flag the owner sets before it looks at its inbox a last time
+    Thread *head = w->inbox.load(std::memory_order_relaxed);
+    do {
+        thread->next = head;
+    } while (!w->inbox.compare_exchange_weak(head, thread));
+    worker_kick(w);
+}
+
+void worker_drain_inbox() {
+    Thread *ordered = thread_list_reverse(this_worker->inbox.exchange(nullptr, std::memory_order_acquire));
+    unsigned drained = 0;
+    while (ordered != nullptr) {
+        Thread *next = ordered->next;
+        ordered->next = nullptr;
+        int ret = this_worker->sched->enqueue(ordered);
+        assert(ret == 0);
+        (void) ret;
+        ordered = next;
+        drained++;
+    }
+    this_worker->incoming.fetch_sub(drained, std::memory_order_relaxed);
+}
+
+void worker_kick(Worker *worker) {
+    // Only the waker that clears the flag kicks, and it marks the worker busy, so worker 0 cannot find everyone idle
+    // before the worker has even woken up
+    if (!worker->parked.load() || !worker->parked.exchange(false)) {
+        return;
+    }
+    parked_workers.fetch_sub(1);
+    if (worker->id != 0) {
+        busy_workers.fetch_add(1);
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(worker->kick_fd, &one, sizeof(one));
+    (void) ret;
+}
+
+// The thief owns the stolen thread from now on: it runs on the thief and, as it has not run, no frame of it refers to
+// the victim's thread-local variables. The deque publishes a thread only once its creator has filled it in, and nothing
+// else looks at a ready thread that is in no queue, so the sweep takes no lock. Its record and stack stay where its
+// creator put them.
+Thread *worker_steal() {
+    if (!work_stealing) {
+        return nullptr;
+    }
+    Worker *self = this_worker;
+    Worker *victim = nullptr;
+    Thread *thread = nullptr;
+    for (unsigned id: self->victims) {
+        victim = &workers[id];
+        thread = static_cast<WorkStealingScheduler *>(victim->sched)->get_policy().steal();
+        if (thread != nullptr) {
+            break;
+        }
+    }
+
+    if (thread == nullptr) {
+        self->steal_failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    thread->worker = self;
+    self->steals.fetch_add(1, std::memory_order_relaxed);
+    int distance = worker_distance(self, victim);
+    if (distance == 0) {
+        self->steals_same_cache.fetch_add(1, std::memory_order_relaxed);
+    } else if (distance == 2) {
+        self->steals_remote_node.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (thread->node != self->node) {
+        self->remote_stacks.fetch_add(1, std::memory_order_relaxed);
+    }
+    return thread;
+}
+
+bool worker_stealable() {
+    for (unsigned id: this_worker->victims) {
+        if (static_cast<WorkStealingScheduler *>(workers[id].sched)->get_policy().stealable()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void worker_kick_thief() {
+    // Orders the push to the deque before the load, against the parked flag a thief sets before it looks at the deques
+    // a last time
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_workers.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    // The nearest sleeping worker, which is also the one that steals from this worker first
+    for (unsigned id: this_worker->victims) {
+        Worker *w = &workers[id];
+        if (w->parked) {
+            worker_kick(w);
+            return;
+        }
+    }
+}
+
+void worker_park_begin() {
+    if (!multi_worker()) {
+        return;
+    }
+    assert(this_worker->id == 0);
+    worker_mark_parked(this_worker);
+}
+
+void worker_park_end() {
+    if (!multi_worker()) {
+        return;
+    }
+    if (this_worker->parked.exchange(false)) {
+        parked_workers.fetch_sub(1);
+    }
+    uint64_t count;
+    ssize_t ret = read(this_worker->kick_fd, &count, sizeof(count));
+    (void) ret;
+}
+
+unsigned MicroFiber::get_worker_id() {
+    return this_worker->id;
+}
+
+StealStats MicroFiber::get_steal_stats() {
+    StealStats stats = {};
+    for (unsigned i = 0; i < worker_count; i++) {
+        stats.steals += workers[i].steals;
+        stats.failed += workers[i].steal_failures;
+    }
+    return stats;
+}
+
+WorkerStats MicroFiber::get_worker_stats(unsigned worker) {
+    WorkerStats stats = {};
+    stats.cpu = -1;
+    if (worker < worker_count) {
+        const Worker *w = &workers[worker];
+        stats.cpu = w->cpu;
+        stats.node = w->node;
+        stats.steals = w->steals;
+        stats.steals_same_cache = w->steals_same_cache;
+        stats.steals_remote_node = w->steals_remote_node;
+        stats.remote_stacks = w->remote_stacks;
+    }
+    return stats;
+}
+
+NodeStats MicroFiber::get_node_stats(int node) {
+    NodeStats stats = {};
+    for (unsigned i = 0; i < worker_count; i++) {
+        const Worker *w = &workers[i];
+        if (w->node == node) {
+            stats.workers++;
+            stats.steals += w->steals;
+            stats.steals_remote_node += w->steals_remote_node;
+            stats.remote_stacks += w->remote_stacks;
+        }
+    }
+    return stats;
+}
+
+int MicroFiber::get_node_count() {
+    return topology_nodes();
+}
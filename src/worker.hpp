@@ -0,0 +1,138 @@
+#ifndef MICROFIBER_WORKER_H
+#define MICROFIBER_WORKER_H
+
+#include <atomic>
+#include <ctime>
+#include <vector>
+#include "microfiber.hpp"
+#include "thread_manager.hpp"
+
+class Scheduler;
+
+// M:N mode. Config::workers system threads each run fibers from their own run queue; the thread that called
+// microfiber_start is worker 0. A fiber stays on the worker it was placed on when created, round-robin. A worker's run
+// queue is only ever touched by that worker: a fiber made ready by another worker is pushed to its worker's inbox, a
+// lock-free stack the owner takes whole at its next scheduling point and enqueues in the order the fibers were pushed.
+//
+// There is no lock over the runtime as a whole. Disabling preemption only keeps the running fiber on its worker; what
+// workers share has locks of its own, each held for a few instructions and never across a switch: the thread table
+// and its free lists, each wait queue, the timing wheel, the io_uring ring, the wake handles, the stack pool. A fiber
+// that blocks marks itself BLOCKED with compare-and-swap and registers where it waits under its own lock; whatever ends
+// the wait claims it with compare-and-swap, so a wait ends once however many workers race to end it (see Thread). A
+// fiber that only computes takes no lock at all.
+//
+// A worker with nothing to run switches to its idle fiber. The idle fiber of worker 0 waits in the event loop, so
+// timers and I/O are driven from there, and ends the process once no fiber is left to run anywhere. The others sleep
+// on an eventfd until a fiber is made ready on their queue.
+//
+// With Config::pin_workers each worker runs on a CPU of its own, and the threads it creates have their records and
+// stacks on its NUMA node. A worker out of threads steals from the workers nearest to it first: those sharing its
+// last-level cache, then those on its node, then the rest.
+
+struct Worker {
+    unsigned id;
+    Scheduler *sched;                   // this worker's run queue
+    Thread idle;                        // runs when the run queue is empty, never enqueued
+    int kick_fd;                        // eventfd written to wake the worker when it sleeps idle
+    std::atomic<bool> parked;           // whether the worker sleeps idle, cleared by whoever kicks it
+    timer_t preempt_timer;              // preemption timer, signalling this worker only
+    std::atomic<bool> has_timer;        // whether preempt_timer has been created
+    std::atomic<bool> timer_armed;      // whether preempt_timer is running, armed by other workers too
+    // Counted by the worker alone, read by the stats calls from any worker
+    std::atomic<unsigned long> steals;              // threads taken from other workers
+    std::atomic<unsigned long> steal_failures;      // sweeps over the other workers that found nothing to take
+    std::atomic<unsigned long> steals_same_cache;   // steals from a worker sharing this worker's last-level cache
+    std::atomic<unsigned long> steals_remote_node;  // steals from a worker on another NUMA node
+    std::atomic<unsigned long> remote_stacks;       // stolen threads whose record and stack are on another NUMA node
+    int cpu;                            // CPU the worker is pinned to, or -1
+    int node;                           // NUMA node of cpu, 0 when not pinned
+    int cache;                          // lowest CPU sharing cpu's last-level cache, or -1
+    std::vector<unsigned> victims;      // the other workers, nearest first, in the order the worker steals from them
+
+    // Threads made ready by other workers, linked through next, newest first, and how many threads other workers
+    // made ready for this one and it has not drained yet, counting those on their way to the inbox. On their own line
+    // as every other worker writes them.
+    alignas(CACHE_LINE_SIZE) std::atomic<Thread *> inbox;
+    std::atomic<unsigned> incoming;
+};
+
+// The workers, indexed by id
+extern Worker *workers;
+
+// The worker of the calling system thread
+extern thread_local Worker *this_worker;
+
+// Number of workers, 1 unless running M:N
+extern unsigned worker_count;
+
+inline bool multi_worker() {
+    return worker_count > 1;
+}
+
+// Whether the workers share work through the WorkStealing scheduler
+extern bool work_stealing;
+
+// Set up the workers, the calling thread becoming worker 0. Must run before the threads are set up.
+void worker_init(const Config *config);
+
+// Start the system threads of the other workers, once the runtime is set up
+void worker_start();
+
+// Stop and join the other workers, called on the way out with preemption disabled
+void worker_end();
+
+// The worker a new thread runs on
+Worker *worker_place();
+
+// Make thread ready through its own worker's inbox, from another worker, kicking that worker if it sleeps
+void worker_ready_remote(Thread *thread);
+
+// Wake worker from its idle sleep, if it sleeps
+void worker_kick(Worker *worker);
+
+// Enqueue the threads of the calling worker's inbox on its run queue
+void worker_drain_inbox();
+
+// Called at every scheduling point, before the run queue is looked at
+inline void worker_poll_inbox() {
+    if (multi_worker() && this_worker->inbox.load(std::memory_order_relaxed) != nullptr) {
+        worker_drain_inbox();
+    }
+}
+
+// Whether another worker has made a thread of the calling worker ready that the worker has not drained yet
+inline bool worker_expects_remote() {
+    return multi_worker() && this_worker->incoming.load(std::memory_order_relaxed) != 0;
+}
+
+// Take a thread that has not run yet from another worker's WorkStealing deque, or nullptr if none has any. Called from
+// the idle fiber.
+Thread *worker_steal();
+
+// Whether another worker's WorkStealing deque holds threads that have not run yet
+bool worker_stealable();
+
+// Wake one sleeping worker so that it can steal
+void worker_kick_thief();
+
+// A thread that has not run yet was made ready on the calling worker; with work stealing, a sleeping worker may take it
+inline void worker_offer(const Thread *thread) {
+    if (work_stealing && !thread->started) {
+        worker_kick_thief();
+    }
+}
+
+// Worker 0 waits in the event loop for timers and I/O on behalf of every worker. Something another worker adds that
+// may change how long that wait should be (an earlier timer, an io_uring submission) wakes it.
+inline void worker_kick_io() {
+    if (multi_worker()) {
+        worker_kick(&workers[0]);
+    }
+}
+
+// Mark worker 0 parked while it waits in the kernel in its idle fiber, so that other workers kick it, and unmark it
+void worker_park_begin();
+
+void worker_park_end();
+
+#endif //MICROFIBER_WORKER_H
@@ -0,0 +1,116 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <cstdio>
+#include <ctime>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define IDLE_US 200000
+
+static int pipe_fds[2];
+static int sock_fds[2];
+
+// CPU time used by the process so far, in microseconds
+static uint64_t cpu_us() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+// Wait for the pipe to become readable and return the byte read
+static int reader(void *arg) {
+    (void) arg;
+    int ret = MicroFiber::thread_wait_io(pipe_fds[0], POLLIN);
+    assert(ret & POLLIN);
+    char c;
+    ret = static_cast<int>(read(pipe_fds[0], &c, 1));
+    assert(ret == 1);
+    return c;
+}
+
+// Write to the pipe after a while
+static int late_writer(void *arg) {
+    (void) arg;
+    MicroFiber::thread_sleep_for(IDLE_US);
+    ssize_t ret = write(pipe_fds[1], "x", 1);
+    assert(ret == 1);
+    (void) ret;
+    return 0;
+}
+
+// Wait for the socket to be writable, while another thread waits for it to be readable
+static int sock_writer(void *arg) {
+    (void) arg;
+    int ret = MicroFiber::thread_wait_io(sock_fds[0], POLLOUT);
+    assert(ret & POLLOUT);
+    return 0;
+}
+
+static int sock_reader(void *arg) {
+    (void) arg;
+    int ret = MicroFiber::thread_wait_io(sock_fds[0], POLLIN);
+    return ret;
+}
+
+// Every thread waits on a timer or an fd for IDLE_US: the process must sleep in the kernel rather than spin, even
+// with preemption on. Also checks that an fd may have a reader and a writer waiting at once, and that a thread
+// waiting for an fd can be killed.
+int main() {
+    int ret;
+    int exit_code;
+
+    printf("starting idle test\n");
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = true,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    ret = pipe(pipe_fds);
+    assert(ret == 0);
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fds);
+    assert(ret == 0);
+
+    uint64_t wall = MicroFiber::get_time_us();
+    uint64_t cpu = cpu_us();
+    ThreadID r = MicroFiber::thread_create(reader, nullptr, 0);
+    ThreadID w = MicroFiber::thread_create(late_writer, nullptr, 0);
+    assert(r >= 0 && w >= 0);
+    ret = MicroFiber::thread_wait(r, &exit_code);
+    assert(ret == 0 && exit_code == 'x');
+    ret = MicroFiber::thread_wait(w, nullptr);
+    assert(ret == 0);
+    wall = MicroFiber::get_time_us() - wall;
+    cpu = cpu_us() - cpu;
+    printf("idle for %lu ms using %lu ms of CPU\n", static_cast<unsigned long>(wall / 1000),
+           static_cast<unsigned long>(cpu / 1000));
+    assert(wall >= IDLE_US);
+    assert(cpu < IDLE_US / 10);
+
+    // The reader keeps waiting on the same fd after the writer is done
+    ThreadID sr = MicroFiber::thread_create(sock_reader, nullptr, 0);
+    ThreadID sw = MicroFiber::thread_create(sock_writer, nullptr, 0);
+    assert(sr >= 0 && sw >= 0);
+    ret = MicroFiber::thread_wait(sw, nullptr);
+    assert(ret == 0);
+    ret = MicroFiber::thread_wait_io(-1, POLLIN);
+    assert(ret == static_cast<int>(MicroFiber::ThreadCodes::INVALID));
+
+    // Kill the reader instead of feeding it
+    ret = MicroFiber::thread_kill(sr);
+    assert(ret == sr);
+    ret = MicroFiber::thread_wait(sr, &exit_code);
+    assert(ret == 0 && exit_code == static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+
+    // The fd is free to wait on again
+    ret = static_cast<int>(write(sock_fds[1], "y", 1));
+    assert(ret == 1);
+    ret = MicroFiber::thread_wait_io(sock_fds[0], POLLIN);
+    assert(ret & POLLIN);
+    (void) ret;
+
+    printf("idle test done\n");
+    MicroFiber::thread_exit(0);
+}
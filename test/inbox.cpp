@@ -0,0 +1,86 @@
+#include "src/microfiber.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+constexpr unsigned NWORKERS = 4;
+constexpr int NTHREADS = 64;
+constexpr int NTOKENS = 16;
+constexpr int ROUNDS = 500;
+
+static std::unique_ptr<std::unique_ptr<Semaphore>[]> sems;
+static std::atomic<unsigned long> passes(0);
+static std::atomic<unsigned> moved(0);
+
+// Takes a token from its own semaphore and hands it to the next thread, which runs on another worker. With many tokens
+// going round at once every worker wakes threads of the others while they do the same to it.
+static int ring_thread(void *arg) {
+    long i = reinterpret_cast<long>(arg);
+    unsigned worker = MicroFiber::get_worker_id();
+    for (int r = 0; r < ROUNDS; r++) {
+        sems[i]->acquire();
+        passes.fetch_add(1, std::memory_order_relaxed);
+        if (MicroFiber::get_worker_id() != worker) {
+            moved.fetch_add(1);
+        }
+        sems[(i + 1) % NTHREADS]->release();
+        if (r % 32 == 0) {
+            MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+        }
+    }
+    return 0;
+}
+
+// Many workers pushing to each other's inboxes at once: every handoff is a wakeup across workers, none is lost and
+// every thread is woken on its own worker
+int main(int argc, const char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting inbox test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = static_cast<bool>(preemptive),
+            .workers = NWORKERS,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    sems.reset(new std::unique_ptr<Semaphore>[NTHREADS]);
+    for (int i = 0; i < NTHREADS; i++) {
+        sems[i].reset(new Semaphore(i % (NTHREADS / NTOKENS) == 0 ? 1 : 0));
+    }
+
+    // Placed round-robin, so neighbours on the ring are on different workers
+    ThreadID tids[NTHREADS];
+    for (long i = 0; i < NTHREADS; i++) {
+        tids[i] = MicroFiber::thread_create(ring_thread, reinterpret_cast<void *>(i), 0);
+        assert(tids[i] >= 0);
+    }
+    for (ThreadID tid: tids) {
+        int ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+        (void) ret;
+    }
+    assert(passes.load() == static_cast<unsigned long>(NTHREADS) * ROUNDS);
+    assert(moved.load() == 0);
+
+    // The tokens end up where they started
+    int tokens = 0;
+    for (int i = 0; i < NTHREADS; i++) {
+        while (sems[i]->try_acquire()) {
+            tokens++;
+        }
+    }
+    assert(tokens == NTOKENS);
+    (void) tokens;
+    sems.reset();
+    printf("%lu handoffs across %u workers\n", passes.load(), NWORKERS);
+
+    printf("inbox test done\n");
+    MicroFiber::thread_exit(0);
+}
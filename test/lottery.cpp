@@ -0,0 +1,58 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <cstdio>
+
+#define NTHREADS 16
+#define ROUNDS 40000
+#define LOW_PRIO 75
+
+static long runs[2];
+static long total = 0;
+
+// Count how often each priority class wins the lottery until ROUNDS draws have been made
+static int count_runs(void *arg) {
+    long cls = reinterpret_cast<long>(arg);
+
+    while (total < ROUNDS) {
+        runs[cls]++;
+        total++;
+        MicroFiber::thread_yield(static_cast<int>(MicroFiber::ThreadCodes::ANY));
+    }
+    return 0;
+}
+
+// Half of the threads run at priority 0 and hold lottery_tickets(0) tickets, the other half at LOW_PRIO. Each class
+// should be scheduled in proportion to its tickets.
+int main() {
+    ThreadID tids[NTHREADS];
+
+    printf("starting lottery test\n");
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::Lottery,
+            .is_preemptive = false,
+            .scheduler_seed = 1,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    for (long i = 0; i < NTHREADS; i++) {
+        long cls = i % 2;
+        tids[i] = MicroFiber::thread_create(count_runs, reinterpret_cast<void *>(cls), cls == 0 ? 0 : LOW_PRIO);
+        assert(tids[i] >= 0);
+    }
+
+    for (ThreadID tid: tids) {
+        int ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+        (void) ret;
+    }
+
+    double expected = static_cast<double>(lottery_tickets(0)) / static_cast<double>(lottery_tickets(LOW_PRIO));
+    double ratio = static_cast<double>(runs[0]) / static_cast<double>(runs[1]);
+    printf("prio 0: %ld runs, prio %d: %ld runs, ratio %.2f (expected about %.2f)\n",
+           runs[0], LOW_PRIO, runs[1], ratio, expected);
+    assert(ratio > expected * 0.8 && ratio < expected * 1.25);
+
+    printf("lottery test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -4,7 +4,6 @@
 #include <array>
 #include <string>
 #include <vector>
-#include <malloc.h>
 
 constexpr int NTHREADS = 128;
 constexpr int LOOPS = 10;
@@ -66,7 +65,8 @@ void grand_finale() {
 int main() {
     Config config = {
             Config::SchedulerType::Random,
-            false
+            false,
+            MAX_THREAD_COUNT
     };
 
     MicroFiber::microfiber_start(&config);
@@ -88,23 +88,24 @@ int main() {
     assert(ret == static_cast<ThreadID>(MicroFiber::ThreadCodes::INVALID));
     printf("initial thread returns from yield(INVALID2)\n");
 
-    struct mallinfo2 minfo = mallinfo2();
-    size_t allocated_space = minfo.uordblks;
+    StackPoolStats stats = MicroFiber::get_stack_pool_stats();
+    unsigned long allocated_stacks = stats.misses;
 
     const char *msg = "hello from first thread";
     ret = MicroFiber::thread_create(hello, const_cast<char *>(msg), 0);
 
-    minfo = mallinfo2();
-    if (minfo.uordblks <= allocated_space) {
-        printf("it appears that the thread stack is not being allocated dynamically\n");
-        assert(false);
-    }
-
     printf("my id is %d\n", MicroFiber::get_thread_id());
     assert(ret >= 0);
     ThreadID ret2 = MicroFiber::thread_yield(ret);
     assert(ret2 == ret);
 
+    // The stack is mapped when the thread first runs
+    stats = MicroFiber::get_stack_pool_stats();
+    if (stats.misses <= allocated_stacks) {
+        printf("it appears that the thread stack is not being allocated dynamically\n");
+        assert(false);
+    }
+
     stack_array[MicroFiber::get_thread_id()] = reinterpret_cast<long *>(&ret);
 
     std::vector<ThreadID> child(MAX_THREAD_COUNT);
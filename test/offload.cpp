@@ -0,0 +1,109 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NBLOCKERS 8
+#define BLOCK_MS 50
+
+static volatile bool blockers_done = false;
+static int ticks = 0;
+
+// Stands in for a call that blocks the system thread running it
+static int block(void *arg) {
+    usleep(static_cast<useconds_t>(reinterpret_cast<long>(arg)) * 1000);
+    return 7;
+}
+
+static int stat_missing(void *arg) {
+    struct stat st{};
+    return stat(static_cast<const char *>(arg), &st);
+}
+
+static int blocker(void *arg) {
+    (void) arg;
+    int ret = MicroFiber::offload(block, reinterpret_cast<void *>(BLOCK_MS));
+    assert(ret == 7);
+    (void) ret;
+    return 0;
+}
+
+// Keeps running while the blockers wait for their calls
+static int ticker(void *arg) {
+    (void) arg;
+    while (!blockers_done) {
+        MicroFiber::thread_sleep_for(1000);
+        ticks++;
+    }
+    return 0;
+}
+
+// The blocking calls of several threads overlap on the pool while the other threads run, errno is carried back, and a
+// thread killed during its call exits once the call returns
+int main(int argc, const char *argv[]) {
+    ThreadID tids[NBLOCKERS];
+    int ret;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting offload test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = static_cast<bool>(preemptive),
+            .offload_threads = 4,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    // With only the main thread, the runtime idles in the event loop until the call returns
+    ret = MicroFiber::offload(block, reinterpret_cast<void *>(1));
+    assert(ret == 7);
+
+    errno = 0;
+    ret = MicroFiber::offload(stat_missing, const_cast<char *>("/nonexistent/microfiber"));
+    assert(ret == -1 && errno == ENOENT);
+
+    uint64_t start = MicroFiber::get_time_us();
+    ThreadID tick = MicroFiber::thread_create(ticker, nullptr, 0);
+    assert(tick >= 0);
+    for (ThreadID &tid: tids) {
+        tid = MicroFiber::thread_create(blocker, nullptr, 0);
+        assert(tid >= 0);
+    }
+    for (ThreadID tid: tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    uint64_t elapsed = MicroFiber::get_time_us() - start;
+    blockers_done = true;
+    ret = MicroFiber::thread_wait(tick, nullptr);
+    assert(ret == 0);
+
+    printf("%d calls of %d ms took %lu ms on 4 workers, the ticker ran %d times meanwhile\n", NBLOCKERS, BLOCK_MS,
+           static_cast<unsigned long>(elapsed / 1000), ticks);
+    assert(elapsed >= 2 * BLOCK_MS * 1000);
+    assert(elapsed < NBLOCKERS * BLOCK_MS * 1000);
+    assert(ticks >= BLOCK_MS);
+
+    // The killed thread still waits for its call, its job is on its stack
+    ThreadID victim = MicroFiber::thread_create(blocker, nullptr, 0);
+    assert(victim >= 0);
+    MicroFiber::thread_yield(victim);
+    start = MicroFiber::get_time_us();
+    ret = MicroFiber::thread_kill(victim);
+    assert(ret == victim);
+    int exit_code;
+    ret = MicroFiber::thread_wait(victim, &exit_code);
+    assert(ret == 0 && exit_code == static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    assert(MicroFiber::get_time_us() - start >= (BLOCK_MS - 5) * 1000);
+    (void) ret;
+
+    printf("offload test done\n");
+    MicroFiber::thread_exit(0);
+}
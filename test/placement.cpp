@@ -0,0 +1,123 @@
+#include "src/microfiber.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+
+constexpr unsigned NWORKERS = 4;
+constexpr long DEPTH = 8;
+constexpr unsigned long LEAF_LOOPS = 200000;
+
+static std::atomic<unsigned> misplaced(0);
+static int cpus_allowed = 0;
+
+// Checks that the calling fiber runs on the CPU its worker is pinned to
+static void check_cpu() {
+    WorkerStats stats = MicroFiber::get_worker_stats(MicroFiber::get_worker_id());
+    if (sched_getcpu() != stats.cpu) {
+        misplaced.fetch_add(1);
+    }
+}
+
+static int tree(void *arg) {
+    long depth = reinterpret_cast<long>(arg);
+    check_cpu();
+    if (depth == 0) {
+        volatile unsigned long sum = 0;
+        for (unsigned long i = 0; i < LEAF_LOOPS; i++) {
+            sum = sum + i;
+        }
+        check_cpu();
+        return 1;
+    }
+
+    ThreadID left = MicroFiber::thread_create(tree, reinterpret_cast<void *>(depth - 1), 0);
+    ThreadID right = MicroFiber::thread_create(tree, reinterpret_cast<void *>(depth - 1), 0);
+    assert(left >= 0 && right >= 0);
+    int left_leaves, right_leaves;
+    int ret = MicroFiber::thread_wait(left, &left_leaves);
+    assert(ret == 0);
+    ret = MicroFiber::thread_wait(right, &right_leaves);
+    assert(ret == 0);
+    (void) ret;
+    return left_leaves + right_leaves;
+}
+
+// Runs on the offload pool, which must not be confined to the CPU of a worker
+static int count_cpus(void *arg) {
+    (void) arg;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    return CPU_COUNT(&set);
+}
+
+// Workers pinned to CPUs: fibers run on their worker's CPU, and the per-worker and per-node counters add up to the
+// totals of the WorkStealing scheduler
+int main(int argc, const char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting placement test, preemptive=%d\n", preemptive);
+
+    cpus_allowed = count_cpus(nullptr);
+    Config config = {
+            .scheduler_name = Config::SchedulerType::WorkStealing,
+            .is_preemptive = static_cast<bool>(preemptive),
+            .workers = NWORKERS,
+            .pin_workers = true,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    for (unsigned i = 0; i < NWORKERS; i++) {
+        WorkerStats stats = MicroFiber::get_worker_stats(i);
+        printf("worker %u: cpu %d, node %d\n", i, stats.cpu, stats.node);
+        assert(stats.cpu >= 0);
+        assert(stats.node >= 0 && stats.node < MicroFiber::get_node_count());
+    }
+    assert(MicroFiber::get_worker_stats(NWORKERS).cpu == -1);
+    check_cpu();
+
+    ThreadID root = MicroFiber::thread_create(tree, reinterpret_cast<void *>(DEPTH), 0);
+    assert(root >= 0);
+    int leaves;
+    int ret = MicroFiber::thread_wait(root, &leaves);
+    assert(ret == 0);
+    assert(leaves == 1 << DEPTH);
+    assert(misplaced.load() == 0);
+
+    ret = MicroFiber::offload(count_cpus, nullptr);
+    assert(ret == cpus_allowed);
+    (void) ret;
+
+    StealStats total = MicroFiber::get_steal_stats();
+    unsigned long steals = 0;
+    for (unsigned i = 0; i < NWORKERS; i++) {
+        WorkerStats stats = MicroFiber::get_worker_stats(i);
+        assert(stats.steals_same_cache + stats.steals_remote_node <= stats.steals);
+        assert(stats.remote_stacks <= stats.steals);
+        steals += stats.steals;
+    }
+    assert(steals == total.steals);
+
+    unsigned workers = 0;
+    unsigned long node_steals = 0;
+    for (int node = 0; node < MicroFiber::get_node_count(); node++) {
+        NodeStats stats = MicroFiber::get_node_stats(node);
+        printf("node %d: %u workers, %lu steals, %lu from other nodes, %lu remote stacks\n", node, stats.workers,
+               stats.steals, stats.steals_remote_node, stats.remote_stacks);
+        workers += stats.workers;
+        node_steals += stats.steals;
+    }
+    assert(workers == NWORKERS);
+    assert(node_steals == total.steals);
+    (void) workers;
+    (void) node_steals;
+    (void) steals;
+
+    printf("placement test done\n");
+    MicroFiber::thread_exit(0);
+}
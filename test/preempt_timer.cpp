@@ -0,0 +1,80 @@
+#include "src/microfiber.hpp"
+#include "src/interrupt_manager.hpp"
+#include <cassert>
+#include <csignal>
+#include <cstdio>
+
+#define QUANTUM 1000
+
+static volatile int worker_ran = 0;
+static volatile int worker_stop = 0;
+
+// Compete with the main thread for the CPU until told to stop
+static int worker(void *arg) {
+    (void) arg;
+    worker_ran = 1;
+    while (!worker_stop) {
+        MicroFiber::spin_wait(QUANTUM);
+    }
+    return 0;
+}
+
+// Run with a 1ms quantum and check that the timer preempts a spinning thread, that ticks arriving in a critical
+// section are deferred and coalesced, that expirations missed while the signal is blocked are counted as overruns,
+// and that the timer stops once the main thread has no competition
+int main() {
+    printf("starting preempt_timer test\n");
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = true,
+            .preempt_quantum_us = QUANTUM,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    // The worker can only run if the timer preempts the spinning main thread
+    ThreadID tid = MicroFiber::thread_create(worker, nullptr, 0);
+    assert(tid >= 0);
+    while (!worker_ran) {
+        MicroFiber::spin_wait(QUANTUM);
+    }
+
+    PreemptStats before = MicroFiber::get_preempt_stats();
+    assert(before.ticks > 0 && before.preemptions > 0);
+
+    // Ticks during a critical section only leave one preemption pending
+    int enabled = InterruptManager::interrupt_off();
+    MicroFiber::spin_wait(QUANTUM * 5);
+    InterruptManager::interrupt_set(enabled);
+
+    PreemptStats critical = MicroFiber::get_preempt_stats();
+    assert(critical.deferred > before.deferred);
+    assert(critical.coalesced > before.coalesced);
+
+    // With the signal blocked the kernel merges the expirations into one pending signal
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIG_TYPE);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    MicroFiber::spin_wait(QUANTUM * 5);
+    sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+
+    PreemptStats blocked = MicroFiber::get_preempt_stats();
+    assert(blocked.overruns >= critical.overruns + 2);
+
+    // Alone again, at most one more tick is taken before the timer is disarmed
+    worker_stop = 1;
+    int ret = MicroFiber::thread_wait(tid, nullptr);
+    assert(ret == 0);
+    (void) ret;
+    PreemptStats alone = MicroFiber::get_preempt_stats();
+    MicroFiber::spin_wait(QUANTUM * 10);
+    PreemptStats idle = MicroFiber::get_preempt_stats();
+    assert(idle.ticks <= alone.ticks + 1);
+    assert(idle.disarms > blocked.disarms);
+
+    printf("ticks %lu overruns %lu preemptions %lu deferred %lu coalesced %lu disarms %lu\n", idle.ticks,
+           idle.overruns, idle.preemptions, idle.deferred, idle.coalesced, idle.disarms);
+    printf("preempt_timer test done\n");
+    MicroFiber::thread_exit(0);
+}
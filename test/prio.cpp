@@ -1,5 +1,6 @@
 #include "src/microfiber.hpp"
 #include <cassert>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 
@@ -47,6 +48,18 @@ int lock_and_print(void *arg) {
 
 static int next_prio = 1;
 
+// Priorities inside, at the edges of and far outside the constant-time levels, in no particular order
+static const int spread_prios[] = {5000, -1, PRIO_LEVEL_MIN + PRIO_LEVELS, 100, INT_MIN + 1, -1000, 0,
+                                   PRIO_LEVEL_MIN + PRIO_LEVELS - 1, PRIO_LEVEL_MIN, PRIO_LEVEL_MIN - 1, 70000, -5};
+constexpr int NSPREAD = sizeof(spread_prios) / sizeof(spread_prios[0]);
+static int ran_prios[NSPREAD];
+static int nran = 0;
+
+int record_prio(void *arg) {
+    ran_prios[nran++] = static_cast<int>(reinterpret_cast<long>(arg));
+    return 0;
+}
+
 int wait_then_killed(void *arg) {
     int ptid = reinterpret_cast<long>(arg);
     int ret;
@@ -79,7 +92,8 @@ int main() {
     ThreadID child[NTHREADS];
     Config config = {
             .scheduler_name = Config::SchedulerType::Prio,
-            .is_preemptive = false
+            .is_preemptive = false,
+            .max_threads = MAX_THREAD_COUNT
     };
 
     MicroFiber::microfiber_start(&config);
@@ -128,6 +142,26 @@ int main() {
 
     delete lock;
 
+    // Every priority keeps its order, within the levels or not: once the initial thread drops to the lowest
+    // priority, the others run lowest number first
+    MicroFiber::set_thread_priority(INT_MIN);
+    ThreadID spread[NSPREAD];
+    for (int i = 0; i < NSPREAD; i++) {
+        spread[i] = MicroFiber::thread_create(record_prio, reinterpret_cast<void *>(static_cast<long>(spread_prios[i])),
+                                              spread_prios[i]);
+        assert(spread[i] >= 0);
+    }
+    assert(nran == 0);
+    MicroFiber::set_thread_priority(INT_MAX);
+    assert(nran == NSPREAD);
+    for (int i = 1; i < NSPREAD; i++) {
+        assert(ran_prios[i - 1] < ran_prios[i]);
+    }
+    for (ThreadID tid: spread) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+
     MicroFiber::set_thread_priority(0);
     wait_then_killed(reinterpret_cast<void *>(-1));
 
@@ -0,0 +1,184 @@
+#include "src/microfiber.hpp"
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#define NCLIENTS 64
+#define ROUNDS 50
+#define MSG_SIZE 32
+
+static int listen_fd;
+static struct sockaddr_in server_addr;
+static int served = 0;
+
+// Echo everything back until the client hangs up
+static int echo(void *arg) {
+    int fd = static_cast<int>(reinterpret_cast<long>(arg));
+    char buf[256];
+    ssize_t n;
+    while ((n = MicroFiber::io_read(fd, buf, sizeof(buf))) > 0) {
+        ssize_t ret = MicroFiber::io_write(fd, buf, static_cast<size_t>(n));
+        assert(ret == n);
+        (void) ret;
+    }
+    assert(n == 0);
+    MicroFiber::io_close(fd);
+    return 0;
+}
+
+// Accept NCLIENTS connections, serving each from a thread of its own
+static int acceptor(void *arg) {
+    (void) arg;
+    for (int i = 0; i < NCLIENTS; i++) {
+        int fd = MicroFiber::io_accept(listen_fd, nullptr, nullptr);
+        assert(fd >= 0);
+        ThreadID tid = MicroFiber::thread_create(echo, reinterpret_cast<void *>(static_cast<long>(fd)), 0);
+        assert(tid >= 0);
+        (void) tid;
+        served++;
+    }
+    return 0;
+}
+
+// Connect and check ROUNDS round trips
+static int client(void *arg) {
+    long id = reinterpret_cast<long>(arg);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    int ret = MicroFiber::io_connect(fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == 0);
+
+    char out[MSG_SIZE], in[MSG_SIZE];
+    for (int r = 0; r < ROUNDS; r++) {
+        snprintf(out, sizeof(out), "client %ld round %d", id, r);
+        ssize_t n = MicroFiber::io_write(fd, out, sizeof(out));
+        assert(n == MSG_SIZE);
+        size_t got = 0;
+        while (got < sizeof(in)) {
+            n = MicroFiber::io_read(fd, in + got, sizeof(in) - got);
+            assert(n > 0);
+            got += static_cast<size_t>(n);
+        }
+        assert(memcmp(in, out, sizeof(in)) == 0);
+    }
+    MicroFiber::io_close(fd);
+    (void) ret;
+    return 0;
+}
+
+static int pipe_fds[2];
+
+// Blocks in io_read until the pipe is closed under it
+static int doomed_reader(void *arg) {
+    (void) arg;
+    char c;
+    ssize_t n = MicroFiber::io_read(pipe_fds[0], &c, 1);
+    assert(n == -1 && errno == EBADF);
+    (void) n;
+    return 0;
+}
+
+// Loopback echo between NCLIENTS client and server threads in one process, then poll timeouts, a refused connection
+// and closing an fd with a thread blocked on it
+int main() {
+    ThreadID clients[NCLIENTS];
+    int ret;
+
+    printf("starting reactor test\n");
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = true,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listen_fd >= 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ret = bind(listen_fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == 0);
+    socklen_t len = sizeof(server_addr);
+    ret = getsockname(listen_fd, reinterpret_cast<struct sockaddr *>(&server_addr), &len);
+    assert(ret == 0);
+    ret = listen(listen_fd, NCLIENTS);
+    assert(ret == 0);
+
+    ThreadID acc = MicroFiber::thread_create(acceptor, nullptr, 0);
+    assert(acc >= 0);
+    for (long i = 0; i < NCLIENTS; i++) {
+        clients[i] = MicroFiber::thread_create(client, reinterpret_cast<void *>(i), 0);
+        assert(clients[i] >= 0);
+    }
+    for (ThreadID tid: clients) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    ret = MicroFiber::thread_wait(acc, nullptr);
+    assert(ret == 0 && served == NCLIENTS);
+    printf("%d clients echoed %d messages each\n", NCLIENTS, ROUNDS);
+
+    // Nothing to accept: poll times out, without keeping the process busy
+    struct pollfd p{listen_fd, POLLIN, 0};
+    uint64_t before = MicroFiber::get_time_us();
+    ret = MicroFiber::io_poll(&p, 1, 30);
+    assert(ret == 0);
+    assert(MicroFiber::get_time_us() - before >= 30000);
+
+    // Nothing listens on the port any more
+    MicroFiber::io_close(listen_fd);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ret = MicroFiber::io_connect(fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == -1 && errno == ECONNREFUSED);
+    MicroFiber::io_close(fd);
+
+    // Several fds at once, one of them ready
+    ret = pipe(pipe_fds);
+    assert(ret == 0);
+    int other[2];
+    ret = pipe(other);
+    assert(ret == 0);
+    ret = static_cast<int>(write(other[1], "z", 1));
+    assert(ret == 1);
+    struct pollfd ps[2] = {{pipe_fds[0], POLLIN, 0}, {other[0], POLLIN, 0}};
+    ret = MicroFiber::io_poll(ps, 2, -1);
+    assert(ret == 1 && ps[0].revents == 0 && (ps[1].revents & POLLIN));
+    MicroFiber::io_close(other[0]);
+    MicroFiber::io_close(other[1]);
+
+    // No fds at all: poll sleeps
+    before = MicroFiber::get_time_us();
+    ret = MicroFiber::io_poll(nullptr, 0, 20);
+    assert(ret == 0);
+    assert(MicroFiber::get_time_us() - before >= 20000);
+
+    // Negative fds are ignored, and the fds polled are left blocking and may be closed with close
+    int quiet[2];
+    ret = pipe(quiet);
+    assert(ret == 0);
+    struct pollfd skip[2] = {{-1, POLLIN, 0}, {quiet[0], POLLIN, 0}};
+    ret = MicroFiber::io_poll(skip, 2, 10);
+    assert(ret == 0 && skip[0].revents == 0);
+    ret = MicroFiber::io_poll(&skip[1], 1, 10);
+    assert(ret == 0);
+    assert(!(fcntl(quiet[0], F_GETFL) & O_NONBLOCK));
+    close(quiet[0]);
+    close(quiet[1]);
+
+    ThreadID doomed = MicroFiber::thread_create(doomed_reader, nullptr, 0);
+    assert(doomed >= 0);
+    MicroFiber::thread_yield(doomed);
+    MicroFiber::io_close(pipe_fds[0]);
+    ret = MicroFiber::thread_wait(doomed, nullptr);
+    assert(ret == 0);
+    (void) ret;
+
+    printf("reactor test done\n");
+    MicroFiber::thread_exit(0);
+}
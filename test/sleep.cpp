@@ -0,0 +1,111 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#define NTHREADS 1000
+#define SPREAD_MS 50
+
+static uint64_t start_us;
+static uint64_t max_late_us = 0;
+static int woken = 0;
+
+// Sleep until a deadline spread over SPREAD_MS and check the thread does not wake early
+static int sleeper(void *arg) {
+    long i = reinterpret_cast<long>(arg);
+    uint64_t deadline = start_us + static_cast<uint64_t>(i % SPREAD_MS) * 1000;
+
+    MicroFiber::thread_sleep_until(deadline);
+
+    uint64_t now = MicroFiber::get_time_us();
+    assert(now >= deadline);
+    if (now - deadline > max_late_us) {
+        max_late_us = now - deadline;
+    }
+    woken++;
+    return 0;
+}
+
+// Sleep for as long as given, crossing the upper levels of the timing wheel
+static int long_sleeper(void *arg) {
+    auto us = static_cast<uint64_t>(reinterpret_cast<long>(arg));
+    uint64_t before = MicroFiber::get_time_us();
+    MicroFiber::thread_sleep_for(us);
+    assert(MicroFiber::get_time_us() - before >= us);
+    return 0;
+}
+
+// Never wakes up by itself
+static int forever(void *arg) {
+    (void) arg;
+    MicroFiber::thread_sleep_for(3600ull * 1000000);
+    assert(false);
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    static ThreadID child[NTHREADS];
+    int preemptive;
+    int ret;
+
+    if (argc == 2) {
+        preemptive = atoi(argv[1]) ? 1 : 0;
+    } else {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("starting sleep test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = preemptive != 0,
+            .max_threads = NTHREADS + 8,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    // Alone, the initial thread waits in the idle loop
+    uint64_t before = MicroFiber::get_time_us();
+    MicroFiber::thread_sleep_for(20000);
+    assert(MicroFiber::get_time_us() - before >= 20000);
+
+    // Many sleepers at once take as long as the longest of them
+    start_us = MicroFiber::get_time_us();
+    for (long i = 0; i < NTHREADS; i++) {
+        child[i] = MicroFiber::thread_create(sleeper, reinterpret_cast<void *>(i), 0);
+        assert(child[i] >= 0);
+    }
+    for (ThreadID tid: child) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    uint64_t elapsed = MicroFiber::get_time_us() - start_us;
+    assert(woken == NTHREADS);
+    printf("%d sleepers woke after %lu ms, at most %lu us late\n", NTHREADS, static_cast<unsigned long>(elapsed / 1000),
+           static_cast<unsigned long>(max_late_us));
+    assert(elapsed < 1000 * 1000);
+
+    // Sleeps that start in level 1 and 2 of the wheel
+    ThreadID mid = MicroFiber::thread_create(long_sleeper, reinterpret_cast<void *>(30000L), 0);
+    ThreadID far = MicroFiber::thread_create(long_sleeper, reinterpret_cast<void *>(450000L), 0);
+    assert(mid >= 0 && far >= 0);
+    ret = MicroFiber::thread_wait(far, nullptr);
+    assert(ret == 0);
+    ret = MicroFiber::thread_wait(mid, nullptr);
+    assert(ret == 0);
+
+    // A sleeping thread can be killed
+    ThreadID victim = MicroFiber::thread_create(forever, nullptr, 0);
+    assert(victim >= 0);
+    MicroFiber::thread_yield(victim);
+    ret = MicroFiber::thread_kill(victim);
+    assert(ret == victim);
+    int exit_code;
+    ret = MicroFiber::thread_wait(victim, &exit_code);
+    assert(ret == 0);
+    assert(exit_code == static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    (void) ret;
+
+    printf("sleep test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,62 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <cstdio>
+
+#define NTHREADS 16
+#define LOOPS 100
+#define POOL_STACKS 4
+
+static int child(void *arg) {
+    return static_cast<int>(reinterpret_cast<long>(arg));
+}
+
+int main() {
+    ThreadID tid[NTHREADS];
+    int exit_code;
+    int ret;
+
+    printf("starting stack pool test\n");
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = false,
+            .stack_pool_high_water = POOL_STACKS * MIN_STACK_SIZE
+    };
+    MicroFiber::microfiber_start(&config);
+
+    // A single short-lived thread at a time should allocate its stack once and then keep reusing it
+    for (long i = 0; i < LOOPS; i++) {
+        ThreadID t = MicroFiber::thread_create(child, reinterpret_cast<void *>(i), 0);
+        assert(t >= 0);
+        ret = MicroFiber::thread_wait(t, &exit_code);
+        assert(ret == 0);
+        assert(exit_code == i);
+    }
+
+    StackPoolStats stats = MicroFiber::get_stack_pool_stats();
+    printf("hits %lu misses %lu trims %lu\n", stats.hits, stats.misses, stats.trims);
+    assert(stats.misses == 1);
+    assert(stats.hits == LOOPS - 1);
+    assert(stats.trims == 0);
+    assert(stats.idle_stacks == 1);
+
+    // More live threads than the pool can hold, the excess is trimmed when they are reaped
+    for (long i = 0; i < NTHREADS; i++) {
+        tid[i] = MicroFiber::thread_create(child, reinterpret_cast<void *>(i), 0);
+        assert(tid[i] >= 0);
+    }
+    for (long i = 0; i < NTHREADS; i++) {
+        ret = MicroFiber::thread_wait(tid[i], &exit_code);
+        assert(ret == 0);
+        assert(exit_code == i);
+    }
+
+    stats = MicroFiber::get_stack_pool_stats();
+    printf("hits %lu misses %lu trims %lu\n", stats.hits, stats.misses, stats.trims);
+    assert(stats.misses == NTHREADS);
+    assert(stats.trims == NTHREADS - POOL_STACKS);
+    assert(stats.idle_stacks == POOL_STACKS);
+
+    printf("stack pool test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,92 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FRAME_SIZE 1024
+#define BIG_STACK (1024 * 1024)
+#define BIG_DEPTH 512
+
+// Use about FRAME_SIZE bytes of stack per level, returns the number of levels visited
+static long recurse(long depth) {
+    volatile char frame[FRAME_SIZE];
+    memset(const_cast<char *>(frame), static_cast<int>(depth), sizeof(frame));
+    if (depth == 0) {
+        return 1;
+    }
+    return recurse(depth - 1) + frame[0] - frame[FRAME_SIZE - 1] + 1;
+}
+
+static int deep(void *arg) {
+    return static_cast<int>(recurse(reinterpret_cast<long>(arg)));
+}
+
+static int overflow(void *arg) {
+    (void) arg;
+    // Far more than MIN_STACK_SIZE, this must hit the guard page
+    recurse(BIG_DEPTH);
+    return 0;
+}
+
+int main() {
+    int status, exit_code;
+    ThreadID tid;
+
+    printf("starting stack size test\n");
+
+    // Overflowing a default-sized stack must fault on the guard page rather than run over other memory
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        Config config = {
+                .scheduler_name = Config::SchedulerType::FCFS,
+                .is_preemptive = false
+        };
+        MicroFiber::microfiber_start(&config);
+        tid = MicroFiber::thread_create(overflow, nullptr, 0);
+        MicroFiber::thread_wait(tid, nullptr);
+        _exit(0);
+    }
+    pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    printf("overflow caught by the guard page\n");
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = false
+    };
+    MicroFiber::microfiber_start(&config);
+
+    // The same recursion fits in a thread that asked for a large stack
+    ThreadAttr attr = {.stack_size = BIG_STACK};
+    tid = MicroFiber::thread_create(deep, reinterpret_cast<void *>(BIG_DEPTH), 0, &attr);
+    assert(tid >= 0);
+    int ret = MicroFiber::thread_wait(tid, &exit_code);
+    assert(ret == 0);
+    assert(exit_code == BIG_DEPTH + 1);
+    printf("%d levels of recursion on a %d byte stack\n", exit_code, BIG_STACK);
+
+    // Small requests are rounded up to the default size
+    attr.stack_size = 1;
+    tid = MicroFiber::thread_create(deep, reinterpret_cast<void *>(8), 0, &attr);
+    assert(tid >= 0);
+    ret = MicroFiber::thread_wait(tid, &exit_code);
+    assert(ret == 0);
+    assert(exit_code == 9);
+
+    // The stack is mapped when the thread first runs, a thread whose stack cannot be mapped exits right away
+    attr.stack_size = size_t{1} << 62;
+    tid = MicroFiber::thread_create(deep, reinterpret_cast<void *>(8), 0, &attr);
+    assert(tid >= 0);
+    ret = MicroFiber::thread_wait(tid, &exit_code);
+    assert(ret == 0);
+    assert(exit_code == static_cast<int>(MicroFiber::ThreadCodes::NO_MEMORY));
+    (void) ret;
+
+    printf("stack size test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,75 @@
+#include "src/microfiber.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+constexpr unsigned NWORKERS = 4;
+constexpr long DEPTH = 9;
+constexpr unsigned long LEAF_LOOPS = 200000;
+
+static std::atomic<unsigned> workers_seen(0);
+
+// Counts the leaves of a binary tree of the given depth, forking a thread per subtree. Every thread is created on the
+// worker of its parent, so only stealing spreads the tree over the other workers.
+static int tree(void *arg) {
+    long depth = reinterpret_cast<long>(arg);
+    workers_seen.fetch_or(1u << MicroFiber::get_worker_id());
+    if (depth == 0) {
+        volatile unsigned long sum = 0;
+        for (unsigned long i = 0; i < LEAF_LOOPS; i++) {
+            sum = sum + i;
+        }
+        return 1;
+    }
+
+    ThreadID left = MicroFiber::thread_create(tree, reinterpret_cast<void *>(depth - 1), 0);
+    ThreadID right = MicroFiber::thread_create(tree, reinterpret_cast<void *>(depth - 1), 0);
+    assert(left >= 0 && right >= 0);
+    // The left subtree is under the right one in the deque, so running it first takes it out of the middle, unless
+    // another worker stole it already
+    ThreadID next = MicroFiber::thread_yield(left);
+    assert(next == left || next == static_cast<ThreadID>(MicroFiber::ThreadCodes::INVALID));
+    (void) next;
+    int left_leaves, right_leaves;
+    int ret = MicroFiber::thread_wait(left, &left_leaves);
+    assert(ret == 0);
+    ret = MicroFiber::thread_wait(right, &right_leaves);
+    assert(ret == 0);
+    (void) ret;
+    return left_leaves + right_leaves;
+}
+
+// A fork-join tree on the WorkStealing scheduler: the result must not depend on where the subtrees ran, and the other
+// workers, which start with nothing, can only have run anything by stealing
+int main(int argc, const char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting work stealing test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::WorkStealing,
+            .is_preemptive = static_cast<bool>(preemptive),
+            .workers = NWORKERS,
+    };
+    MicroFiber::microfiber_start(&config);
+
+    ThreadID root = MicroFiber::thread_create(tree, reinterpret_cast<void *>(DEPTH), 0);
+    assert(root >= 0);
+    int leaves;
+    int ret = MicroFiber::thread_wait(root, &leaves);
+    assert(ret == 0);
+    (void) ret;
+
+    StealStats stats = MicroFiber::get_steal_stats();
+    printf("leaves %d, steals %lu, failed sweeps %lu, workers seen %#x\n", leaves, stats.steals, stats.failed,
+           workers_seen.load());
+    assert(leaves == 1 << DEPTH);
+    assert((stats.steals > 0) == (workers_seen.load() != 1));
+
+    printf("work stealing test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,116 @@
+#include "src/microfiber.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+
+#define TOTAL 1000000
+#define BATCH 20000
+#define RESIDENT 1000000
+
+static long live = 0;
+
+// Resident set size of the process in bytes
+static long rss_bytes() {
+    long pages_total, pages_resident;
+    FILE *f = fopen("/proc/self/statm", "r");
+    assert(f != nullptr);
+    int ret = fscanf(f, "%ld %ld", &pages_total, &pages_resident);
+    assert(ret == 2);
+    fclose(f);
+    return pages_resident * sysconf(_SC_PAGESIZE);
+}
+
+static int short_lived(void *arg) {
+    live++;
+    // Let every other thread of the batch start before exiting
+    MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    live--;
+    return static_cast<int>(reinterpret_cast<long>(arg));
+}
+
+static int never_runs(void *arg) {
+    (void) arg;
+    assert(false);
+    return 0;
+}
+
+int main() {
+    static ThreadID tid[BATCH];
+    static ThreadID resident[RESIDENT];
+    std::chrono::steady_clock::duration create_time{}, reap_time{};
+    long peak_rss = 0;
+    int exit_code;
+
+    printf("starting stress test, %d threads in batches of %d, then %d at once\n", TOTAL, BATCH, RESIDENT);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = false,
+            .max_threads = RESIDENT + 1,
+            .stack_pool_high_water = static_cast<size_t>(BATCH) * MIN_STACK_SIZE
+    };
+    MicroFiber::microfiber_start(&config);
+
+    long base_rss = rss_bytes();
+
+    for (long done = 0; done < TOTAL; done += BATCH) {
+        auto start = std::chrono::steady_clock::now();
+        for (long i = 0; i < BATCH; i++) {
+            tid[i] = MicroFiber::thread_create(short_lived, reinterpret_cast<void *>(i), 0);
+            assert(tid[i] >= 0);
+        }
+        create_time += std::chrono::steady_clock::now() - start;
+
+        // Run every thread up to its yield
+        MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+        assert(live == BATCH);
+        if (rss_bytes() > peak_rss) {
+            peak_rss = rss_bytes();
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (long i = 0; i < BATCH; i++) {
+            int ret = MicroFiber::thread_wait(tid[i], &exit_code);
+            assert(ret == 0);
+            assert(exit_code == i);
+        }
+        reap_time += std::chrono::steady_clock::now() - start;
+        assert(live == 0);
+    }
+
+    // A million threads alive at once, which fill the table. None of them has run, so each costs only its record, and
+    // killing them needs no stack either.
+    long before_rss = rss_bytes();
+    for (ThreadID &t: resident) {
+        t = MicroFiber::thread_create(never_runs, nullptr, 0);
+        assert(t >= 0);
+    }
+    long resident_rss = rss_bytes() - before_rss;
+    ThreadID extra = MicroFiber::thread_create(never_runs, nullptr, 0);
+    assert(extra == static_cast<ThreadID>(MicroFiber::ThreadCodes::MAX_THREADS));
+    (void) extra;
+    for (ThreadID t: resident) {
+        ThreadID ret = MicroFiber::thread_kill(t);
+        assert(ret == t);
+        (void) ret;
+    }
+    for (ThreadID t: resident) {
+        int ret = MicroFiber::thread_wait(t, &exit_code);
+        assert(ret == 0);
+        assert(exit_code == static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+        (void) ret;
+    }
+
+    double create_secs = std::chrono::duration<double>(create_time).count();
+    double reap_secs = std::chrono::duration<double>(reap_time).count();
+    StackPoolStats stats = MicroFiber::get_stack_pool_stats();
+
+    printf("create: %.0f threads/s\n", TOTAL / create_secs);
+    printf("run and reap: %.0f threads/s\n", TOTAL / reap_secs);
+    printf("memory: %ld bytes per live thread that has run\n", (peak_rss - base_rss) / BATCH);
+    printf("memory: %ld bytes per live thread with %d alive\n", resident_rss / RESIDENT, RESIDENT);
+    printf("stack pool: %lu hits %lu misses\n", stats.hits, stats.misses);
+    printf("stress test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,214 @@
+#include "src/microfiber.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+constexpr int NPRODUCERS = 4;
+constexpr int NCONSUMERS = 4;
+constexpr int ITEMS = 2000;
+constexpr int BUFFER_SIZE = 8;
+
+constexpr int SEM_UNITS = 3;
+constexpr int SEM_THREADS = 16;
+constexpr int SEM_ROUNDS = 50;
+
+constexpr int NLOCKS = 1 << 16;
+constexpr int LOCK_THREADS = 32;
+
+static void yield() {
+    MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+}
+
+// A bounded buffer on a Lock and two Conditions
+static Lock buffer_lock;
+static Condition not_full;
+static Condition not_empty;
+static int buffer[BUFFER_SIZE];
+static int buffer_head = 0;
+static int buffer_count = 0;
+static long consumed_sum = 0;
+
+static int producer(void *arg) {
+    long base = reinterpret_cast<long>(arg) * ITEMS;
+    for (int i = 1; i <= ITEMS; i++) {
+        buffer_lock.acquire();
+        while (buffer_count == BUFFER_SIZE) {
+            not_full.wait(buffer_lock);
+        }
+        buffer[(buffer_head + buffer_count) % BUFFER_SIZE] = static_cast<int>(base + i);
+        buffer_count++;
+        not_empty.notify_one();
+        buffer_lock.release();
+        if (i % 7 == 0) {
+            yield();
+        }
+    }
+    return 0;
+}
+
+static int consumer(void *arg) {
+    (void) arg;
+    long sum = 0;
+    for (int i = 0; i < NPRODUCERS * ITEMS / NCONSUMERS; i++) {
+        buffer_lock.acquire();
+        while (buffer_count == 0) {
+            not_empty.wait(buffer_lock);
+        }
+        sum += buffer[buffer_head];
+        buffer_head = (buffer_head + 1) % BUFFER_SIZE;
+        buffer_count--;
+        not_full.notify_one();
+        buffer_lock.release();
+    }
+    buffer_lock.acquire();
+    consumed_sum += sum;
+    buffer_lock.release();
+    return 0;
+}
+
+// A Semaphore bounding how many threads are inside at once
+static Semaphore sem(SEM_UNITS);
+static std::atomic<int> inside(0);
+static std::atomic<int> most_inside(0);
+
+static int sem_thread(void *arg) {
+    (void) arg;
+    for (int i = 0; i < SEM_ROUNDS; i++) {
+        sem.acquire();
+        int now = ++inside;
+        assert(now <= SEM_UNITS);
+        int most = most_inside;
+        while (now > most && !most_inside.compare_exchange_weak(most, now)) {
+        }
+        yield();
+        inside--;
+        sem.release();
+        yield();
+    }
+    return 0;
+}
+
+// Many more locks than the parking lot has buckets, each guarding its own counter
+static std::unique_ptr<Lock[]> locks;
+static std::unique_ptr<int[]> counters;
+
+static int lock_thread(void *arg) {
+    long stride = 2 * reinterpret_cast<long>(arg) + 1;
+    for (long k = 0; k < NLOCKS; k++) {
+        long i = (k * stride) % NLOCKS;
+        locks[i].acquire();
+        int value = counters[i];
+        if (k % 64 == 0) {
+            yield();
+        }
+        counters[i] = value + 1;
+        locks[i].release();
+    }
+    return 0;
+}
+
+static Lock kill_lock;
+
+static int blocked_locker(void *arg) {
+    (void) arg;
+    kill_lock.acquire();
+    kill_lock.release();
+    return 0;
+}
+
+// Lock, Condition and Semaphore on the parking lot: a Lock is a single word, waiters are woken in order across many
+// addresses sharing buckets, and a thread parked on a lock can be killed
+int main(int argc, const char *argv[]) {
+    int ret;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting sync test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = static_cast<bool>(preemptive),
+    };
+    MicroFiber::microfiber_start(&config);
+    static_assert(sizeof(Lock) == 4, "Lock is a single word");
+
+    ThreadID tids[NPRODUCERS + NCONSUMERS];
+    for (long i = 0; i < NPRODUCERS; i++) {
+        tids[i] = MicroFiber::thread_create(producer, reinterpret_cast<void *>(i), 0);
+        assert(tids[i] >= 0);
+    }
+    for (int i = 0; i < NCONSUMERS; i++) {
+        tids[NPRODUCERS + i] = MicroFiber::thread_create(consumer, nullptr, 0);
+        assert(tids[NPRODUCERS + i] >= 0);
+    }
+    for (ThreadID tid: tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    long total = static_cast<long>(NPRODUCERS) * ITEMS;
+    assert(buffer_count == 0);
+    assert(consumed_sum == total * (total + 1) / 2);
+    printf("bounded buffer passed %ld items\n", total);
+
+    ThreadID sem_tids[SEM_THREADS];
+    for (ThreadID &tid: sem_tids) {
+        tid = MicroFiber::thread_create(sem_thread, nullptr, 0);
+        assert(tid >= 0);
+    }
+    for (ThreadID tid: sem_tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    assert(inside == 0);
+    assert(most_inside == SEM_UNITS);
+    bool taken = sem.try_acquire();
+    assert(taken);
+    sem.release();
+    printf("semaphore let at most %d threads in\n", most_inside.load());
+
+    locks.reset(new Lock[NLOCKS]);
+    counters.reset(new int[NLOCKS]());
+    ThreadID lock_tids[LOCK_THREADS];
+    for (long i = 0; i < LOCK_THREADS; i++) {
+        lock_tids[i] = MicroFiber::thread_create(lock_thread, reinterpret_cast<void *>(i), 0);
+        assert(lock_tids[i] >= 0);
+    }
+    for (ThreadID tid: lock_tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    for (int i = 0; i < NLOCKS; i++) {
+        assert(counters[i] == LOCK_THREADS);
+    }
+    locks.reset();
+    printf("%d locks each taken by %d threads\n", NLOCKS, LOCK_THREADS);
+
+    // Kill a thread parked on a held lock, which then still works for the others
+    kill_lock.acquire();
+    taken = kill_lock.try_acquire();
+    assert(!taken);
+    ThreadID victim = MicroFiber::thread_create(blocked_locker, nullptr, 0);
+    assert(victim >= 0);
+    yield();
+    ret = MicroFiber::thread_kill(victim);
+    assert(ret == victim);
+    int code;
+    ret = MicroFiber::thread_wait(victim, &code);
+    assert(ret == 0 && code == static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    ThreadID other = MicroFiber::thread_create(blocked_locker, nullptr, 0);
+    assert(other >= 0);
+    yield();
+    kill_lock.release();
+    ret = MicroFiber::thread_wait(other, nullptr);
+    assert(ret == 0);
+    (void) ret;
+    (void) taken;
+
+    printf("sync test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,146 @@
+#include "src/microfiber.hpp"
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#define NTHREADS 64
+#define BLOCK 4096
+
+static int file_fd;
+static int listen_fd;
+static struct sockaddr_in server_addr;
+
+// Write a block of the file, sync it, and read it back
+static int file_worker(void *arg) {
+    long i = reinterpret_cast<long>(arg);
+    char out[BLOCK], in[BLOCK];
+    memset(out, static_cast<int>('a' + i % 26), sizeof(out));
+
+    ssize_t n = MicroFiber::io_pwrite(file_fd, out, sizeof(out), static_cast<off_t>(i * BLOCK));
+    assert(n == BLOCK);
+    int ret = MicroFiber::io_fsync(file_fd);
+    assert(ret == 0);
+    n = MicroFiber::io_pread(file_fd, in, sizeof(in), static_cast<off_t>(i * BLOCK));
+    assert(n == BLOCK);
+    assert(memcmp(in, out, sizeof(in)) == 0);
+    (void) n;
+    (void) ret;
+    return 0;
+}
+
+// Accept one connection and read a byte from it
+static int acceptor(void *arg) {
+    (void) arg;
+    int fd = MicroFiber::io_accept(listen_fd, nullptr, nullptr);
+    assert(fd >= 0);
+    char c;
+    ssize_t n = MicroFiber::io_read(fd, &c, 1);
+    assert(n == 1);
+    (void) n;
+    MicroFiber::io_close(fd);
+    return c;
+}
+
+// Waits for a connection that never comes
+static int lonely_acceptor(void *arg) {
+    (void) arg;
+    MicroFiber::io_accept(listen_fd, nullptr, nullptr);
+    assert(false);
+    return 0;
+}
+
+// File, accept and socket reads through io_uring (argument 1) or through the fallback paths (argument 0), and killing
+// a thread whose operation is still in flight
+int main(int argc, const char *argv[]) {
+    ThreadID tids[NTHREADS];
+    int ret;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool use_io_uring = atoi(argv[1]) != 0;
+    printf("starting uring test, use_io_uring=%d\n", use_io_uring);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = true,
+            .use_io_uring = use_io_uring,
+    };
+    MicroFiber::microfiber_start(&config);
+    UringStats stats = MicroFiber::get_uring_stats();
+    printf("io_uring %s\n", stats.enabled ? "enabled" : "not in use");
+    assert(!stats.enabled || use_io_uring);
+
+    char path[] = "/tmp/microfiber_uringXXXXXX";
+    file_fd = mkstemp(path);
+    assert(file_fd >= 0);
+    unlink(path);
+
+    for (long i = 0; i < NTHREADS; i++) {
+        tids[i] = MicroFiber::thread_create(file_worker, reinterpret_cast<void *>(i), 0);
+        assert(tids[i] >= 0);
+    }
+    for (ThreadID tid: tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    close(file_fd);
+
+    stats = MicroFiber::get_uring_stats();
+    printf("%lu operations submitted in %lu io_uring_enter calls\n", stats.submissions, stats.enters);
+    if (stats.enabled) {
+        // The threads block in the same rounds, so their operations share submissions
+        assert(stats.submissions == 3 * NTHREADS);
+        assert(stats.enters < stats.submissions / 4);
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listen_fd >= 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ret = bind(listen_fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == 0);
+    socklen_t len = sizeof(server_addr);
+    ret = getsockname(listen_fd, reinterpret_cast<struct sockaddr *>(&server_addr), &len);
+    assert(ret == 0);
+    ret = listen(listen_fd, 4);
+    assert(ret == 0);
+
+    unsigned long submitted = stats.submissions;
+    ThreadID acc = MicroFiber::thread_create(acceptor, nullptr, 0);
+    assert(acc >= 0);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ret = MicroFiber::io_connect(fd, reinterpret_cast<struct sockaddr *>(&server_addr), sizeof(server_addr));
+    assert(ret == 0);
+    ret = static_cast<int>(MicroFiber::io_write(fd, "k", 1));
+    assert(ret == 1);
+    int exit_code;
+    ret = MicroFiber::thread_wait(acc, &exit_code);
+    assert(ret == 0 && exit_code == 'k');
+    MicroFiber::io_close(fd);
+
+    // The accept, the write and the read all went through the ring
+    stats = MicroFiber::get_uring_stats();
+    assert(!stats.enabled || stats.submissions >= submitted + 3);
+    (void) submitted;
+
+    // The killed thread only exits once its accept has been cancelled
+    ThreadID lonely = MicroFiber::thread_create(lonely_acceptor, nullptr, 0);
+    assert(lonely >= 0);
+    MicroFiber::thread_yield(lonely);
+    ret = MicroFiber::thread_kill(lonely);
+    assert(ret == lonely);
+    ret = MicroFiber::thread_wait(lonely, &exit_code);
+    assert(ret == 0 && exit_code == static_cast<int>(MicroFiber::ThreadCodes::KILLED));
+    (void) ret;
+
+    printf("uring test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,172 @@
+#include "src/microfiber.hpp"
+#include <atomic>
+#include <cassert>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <thread>
+
+constexpr int NPAIRS = 4;
+constexpr int ROUNDS = 2000;
+
+static WakeHandle handles[NPAIRS];
+static std::atomic<int> acked[NPAIRS];
+static WakeHandle signal_handle;
+
+// Handles on the stack of their waiter, published for the foreign thread of their pair to fire once
+static std::atomic<WakeHandle *> published[NPAIRS];
+
+// Fires the handle of its pair once per round, and waits for the thread to have seen it before the next one, so that
+// no fire is folded into an earlier one
+static void foreign(int pair) {
+    for (int round = 0; round < ROUNDS; round++) {
+        handles[pair].fire();
+        while (acked[pair].load() <= round) {
+            sched_yield();
+        }
+    }
+}
+
+// Fires each handle its pair publishes, and is still inside fire while the waiter may already be destroying it
+static void foreign_published(int pair) {
+    for (int round = 0; round < ROUNDS; round++) {
+        WakeHandle *handle;
+        while ((handle = published[pair].exchange(nullptr)) == nullptr) {
+            sched_yield();
+        }
+        handle->fire();
+    }
+}
+
+// Waits on a fresh handle every round and destroys it as soon as the wait returns
+static int stack_waiter(void *arg) {
+    long pair = reinterpret_cast<long>(arg);
+    for (int round = 0; round < ROUNDS; round++) {
+        WakeHandle handle;
+        published[pair].store(&handle);
+        int ret = handle.wait();
+        assert(ret == 0);
+        (void) ret;
+    }
+    return 0;
+}
+
+static int waiter(void *arg) {
+    long pair = reinterpret_cast<long>(arg);
+    for (int round = 0; round < ROUNDS; round++) {
+        int ret = handles[pair].wait();
+        assert(ret == 0);
+        (void) ret;
+        acked[pair].store(round + 1);
+    }
+    return 0;
+}
+
+// A thread that computes, so the waiters are also woken while other threads are ready to run
+static int busy(void *arg) {
+    (void) arg;
+    for (int i = 0; i < 200; i++) {
+        volatile unsigned long sum = 0;
+        for (unsigned long j = 0; j < 20000; j++) {
+            sum = sum + j;
+        }
+        MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    }
+    return 0;
+}
+
+static void on_signal(int sig) {
+    (void) sig;
+    signal_handle.fire();
+}
+
+// Wakeups from system threads the runtime does not know about, and from a signal handler
+int main(int argc, const char *argv[]) {
+    int ret;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting wake test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = static_cast<bool>(preemptive),
+    };
+    MicroFiber::microfiber_start(&config);
+
+    // Fired before the wait, which returns at once
+    handles[0].fire();
+    handles[0].fire();
+    ret = handles[0].wait();
+    assert(ret == 0);
+
+    // The only thread waits on a handle, so the runtime sleeps in the kernel until the signal arrives
+    struct sigaction sa{};
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    ret = sigaction(SIGUSR1, &sa, nullptr);
+    assert(ret == 0);
+    std::thread signaller([] {
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, nullptr);
+        kill(getpid(), SIGUSR1);
+    });
+    ret = signal_handle.wait();
+    assert(ret == 0);
+    signaller.join();
+    printf("woken by a signal handler\n");
+
+    ThreadID tids[NPAIRS];
+    std::thread threads[NPAIRS];
+    ThreadID busy_tid = MicroFiber::thread_create(busy, nullptr, 0);
+    assert(busy_tid >= 0);
+    for (long i = 0; i < NPAIRS; i++) {
+        tids[i] = MicroFiber::thread_create(waiter, reinterpret_cast<void *>(i), 0);
+        assert(tids[i] >= 0);
+    }
+    for (int i = 0; i < NPAIRS; i++) {
+        threads[i] = std::thread(foreign, i);
+    }
+    for (ThreadID tid: tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    ret = MicroFiber::thread_wait(busy_tid, nullptr);
+    assert(ret == 0);
+    (void) ret;
+    for (auto &count: acked) {
+        assert(count.load() == ROUNDS);
+    }
+    printf("woken by foreign threads\n");
+
+    busy_tid = MicroFiber::thread_create(busy, nullptr, 0);
+    assert(busy_tid >= 0);
+    for (long i = 0; i < NPAIRS; i++) {
+        tids[i] = MicroFiber::thread_create(stack_waiter, reinterpret_cast<void *>(i), 0);
+        assert(tids[i] >= 0);
+    }
+    for (int i = 0; i < NPAIRS; i++) {
+        threads[i] = std::thread(foreign_published, i);
+    }
+    for (ThreadID tid: tids) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    for (auto &t: threads) {
+        t.join();
+    }
+    ret = MicroFiber::thread_wait(busy_tid, nullptr);
+    assert(ret == 0);
+    printf("handles destroyed right after their wait\n");
+
+    printf("wake test done\n");
+    MicroFiber::thread_exit(0);
+}
@@ -0,0 +1,138 @@
+#include "src/microfiber.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+constexpr unsigned NWORKERS = 4;
+constexpr int NSPINNERS = 16;
+constexpr int NLOCKERS = 32;
+constexpr int NLOCKLOOPS = 500;
+constexpr int CHAIN = 64;
+constexpr int NSLEEPERS = 8;
+constexpr uint64_t SLEEP_US = 10000;
+
+static std::atomic<unsigned> workers_seen(0);
+static Lock *testlock;
+static unsigned long counter = 0;
+static ThreadID chain[CHAIN];
+static std::atomic<bool> chain_ready(false);
+
+// Computes without ever yielding, only preemption lets the threads sharing its worker run
+static int spinner(void *arg) {
+    workers_seen.fetch_or(1u << MicroFiber::get_worker_id());
+    volatile unsigned long sum = 0;
+    for (unsigned long i = 0; i < 2000000; i++) {
+        sum = sum + i * reinterpret_cast<unsigned long>(arg);
+    }
+    return 0;
+}
+
+// A plain increment, so a lost update shows if the lock does not exclude threads of other workers
+static int locker(void *arg) {
+    (void) arg;
+    for (int i = 0; i < NLOCKLOOPS; i++) {
+        testlock->acquire();
+        unsigned long value = counter;
+        if (i % 16 == 0) {
+            MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+        }
+        counter = value + 1;
+        testlock->release();
+    }
+    return 0;
+}
+
+// Each link waits for the previous one, which runs on another worker. Links start running on the other workers while
+// main is still creating them, so they hold off until every ID is known.
+static int link(void *arg) {
+    long i = reinterpret_cast<long>(arg);
+    while (!chain_ready.load()) {
+        MicroFiber::thread_yield(static_cast<ThreadID>(MicroFiber::ThreadCodes::ANY));
+    }
+    if (i == 0) {
+        return 1;
+    }
+    int exit_code;
+    int ret = MicroFiber::thread_wait(chain[i - 1], &exit_code);
+    assert(ret == 0);
+    (void) ret;
+    return exit_code + 1;
+}
+
+static int sleeper(void *arg) {
+    (void) arg;
+    uint64_t before = MicroFiber::get_time_us();
+    MicroFiber::thread_sleep_for(SLEEP_US);
+    assert(MicroFiber::get_time_us() - before >= SLEEP_US);
+    return 0;
+}
+
+// Threads spread over several workers: preemption on each of them, a Lock and thread_wait across workers, and sleeps
+// on workers other than the one driving the timers
+int main(int argc, const char *argv[]) {
+    int ret;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s 0|1\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int preemptive = atoi(argv[1]) ? 1 : 0;
+    printf("starting workers test, preemptive=%d\n", preemptive);
+
+    Config config = {
+            .scheduler_name = Config::SchedulerType::FCFS,
+            .is_preemptive = static_cast<bool>(preemptive),
+            .workers = NWORKERS,
+    };
+    MicroFiber::microfiber_start(&config);
+    assert(MicroFiber::get_worker_id() == 0);
+
+    ThreadID spinners[NSPINNERS];
+    for (long i = 0; i < NSPINNERS; i++) {
+        spinners[i] = MicroFiber::thread_create(spinner, reinterpret_cast<void *>(i), 0);
+        assert(spinners[i] >= 0);
+    }
+    for (ThreadID tid: spinners) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    assert(workers_seen.load() == (1u << NWORKERS) - 1);
+
+    testlock = new Lock();
+    ThreadID lockers[NLOCKERS];
+    for (ThreadID &tid: lockers) {
+        tid = MicroFiber::thread_create(locker, nullptr, 0);
+        assert(tid >= 0);
+    }
+    for (ThreadID tid: lockers) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    printf("counter %lu\n", counter);
+    assert(counter == static_cast<unsigned long>(NLOCKERS) * NLOCKLOOPS);
+
+    // Created in reverse, so that most links wait for a thread that has not run yet
+    for (long i = CHAIN - 1; i >= 0; i--) {
+        chain[i] = MicroFiber::thread_create(link, reinterpret_cast<void *>(i), 0);
+        assert(chain[i] >= 0);
+    }
+    chain_ready.store(true);
+    int exit_code;
+    ret = MicroFiber::thread_wait(chain[CHAIN - 1], &exit_code);
+    assert(ret == 0 && exit_code == CHAIN);
+
+    ThreadID sleepers[NSLEEPERS];
+    for (ThreadID &tid: sleepers) {
+        tid = MicroFiber::thread_create(sleeper, nullptr, 0);
+        assert(tid >= 0);
+    }
+    for (ThreadID tid: sleepers) {
+        ret = MicroFiber::thread_wait(tid, nullptr);
+        assert(ret == 0);
+    }
+    (void) ret;
+
+    printf("workers test done\n");
+    MicroFiber::thread_exit(0);
+}